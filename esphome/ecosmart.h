@@ -1,76 +1,80 @@
 #include "esphome.h"
-#include <IRremoteESP8266.h>
-#include <IRrecv.h>
-#include <IRutils.h>
 #include <ESP8266WiFi.h>
+#include "ecosmart_protocol.h"
+#include "ecosmart_frame.h"
+#include "ecosmart_temperature.h"
+#include "ecosmart_publisher.h"
+#include "ecosmart_commands.h"
+#include "ecosmart_tx.h"
+#include "ecosmart_decoder.h"
+#include "ecosmart_channel.h"
+#include "ecosmart_stats.h"
+#include "ecosmart_usage.h"
 
 #define get_ecosmart(constructor) static_cast<EcoSmart *>(const_cast<custom_component::CustomComponentConstructor *>(&constructor)->get_component(0))
 
-const uint8_t ECOSMART_TEMP_MIN = 27; // Celsius
-const uint8_t ECOSMART_TEMP_MAX = 60; // Celsius
-
-#define OUTPUT_PIN 12 // D6 on NodeMCU
+#define OUTPUT_PIN 12 // D6 on NodeMCU, the default for new EcoSmart()
 #define RECV_PIN 4    // D2 on NodeMCU
 
-#define ECOSMART_HDR_MARK 7000U
-#define ECOSMART_HDR_SPACE 4000U
-#define ECOSMART_BIT_MARK_HIGH 2400U
-#define ECOSMART_BIT_MARK_LOW 720U
-#define ECOSMART_BIT_SPACE 840U
-#define ECOSMART_RPT_SPACE 2700U
-
-#define ECOSMART_ON_BIT_SHIFT 19
-#define ECOSMART_C_BIT_SHIFT 20
-#define ECOSMART_FLOW_BIT_SHIFT 21
-#define ECOSMART_TEMP_F_SHIFT 8
-#define ECOSMART_TEMP_C_SHIFT 0
-
-#define RPT_CODES 5 // number of times to repeat sending the code (0 for no repeats)
-
-// IR library
-#define OFFSET_START 1U
-#define MIN_UNKNOWN_SIZE 12
-#define CAPTURE_BUFFER_SIZE 1024
-#define TIMEOUT 15U // Suits most messages, while not swallowing many repeats.
-#define RAWBUF 100U
-
-int codeType = -1;             // The type of code
-unsigned long codeValue;       // The code value if not raw
-unsigned int rawCodes[RAWBUF]; // The durations if raw
-int codeLen;                   // The length of the code
+#define RPT_CODES 0 // number of times to repeat sending the code (0 for no repeats)
 
 #define INITIAL_COMMAND 0x0F3C186929 // When this device restarts, it should have an initial state (105/41)
 
+#define STATE_MIN_INTERVAL_MS 1000       // changed fields are published at most this often
+#define STATE_REFRESH_INTERVAL_MS 300000 // everything is republished this often (0 to only publish changes)
+#define COMMAND_SETTLE_MS 300            // commands are merged until none has arrived for this long (off is sent at once)
+#define CONFIRM_TIMEOUT_MS 2000          // resend a command the heater has not reported after this long...
+#define CONFIRM_RETRIES 3                // ...this many times, doubling the wait (timeout 0 trusts every send)
+#define TX_MAX_DEFER_MS 1000             // longest a command waits for the heater to stop talking
+#define STATS_INTERVAL_MS 60000          // diagnostic sensors are updated this often
+#define USAGE_INTERVAL_MS 3600000        // hot-water draws are summarised over this interval
+#define CAPTURE_SAMPLE_EVERY 1           // log a raw capture of one failed decode in this many...
+#define CAPTURE_PER_MINUTE 6             // ...and at most this many a minute (0 to turn capturing off)
+#define TX_LEARNED_TIMING false          // transmit with the widths learned from the heater's own frames...
+#define TX_LEARNED_TIMING_FRAMES 64      // ...once they were learned from this many
+
 static const char *TAG = "ecosmart";
 
-bool use_c = true;
-bool stateOn = false;
-bool stateFlow = false;
-uint64_t cmd;
+// Shared by all EcoSmart components: there is one timer to transmit with
+EcoSmartScheduler scheduler;
+// Per heater, indexed as the scheduler registered them: each component
+// publishes and resets only its own
+EcoSmartHistogram txStats[ECOSMART_MAX_CHANNELS];    // starting a transmission
+EcoSmartHistogram deferStats[ECOSMART_MAX_CHANNELS]; // ms a due command waited for the heater to fall quiet
 
-IRrecv irrecv(RECV_PIN, CAPTURE_BUFFER_SIZE, TIMEOUT, true);
-// IRrecv irrecv(RECV_PIN);
-decode_results results;
+// Start the next due transmission, whichever heater it is for. Every EcoSmart
+// component calls this from its loop().
+void transmitCommands()
+{
+  uint32_t start = micros();
+  EcoSmartChannel *channel = scheduler.loop(millis());
+  if (channel == nullptr)
+  {
+    return;
+  }
+  uint32_t elapsed = micros() - start;
+  for (uint8_t i = 0; i < scheduler.channels(); i++)
+  {
+    if (scheduler.channel(i) == channel)
+    {
+      txStats[i].add(elapsed);
+      deferStats[i].add(scheduler.deferredMs());
+    }
+  }
+  ESP_LOGV(TAG, "Sending command on pin %u: 0x0F%08X (deferred %u ms, %u frames sent for %u commands)",
+           channel->txPin(), static_cast<uint32_t>(channel->commander().target().raw()), scheduler.deferredMs(),
+           channel->commander().framesSent(), channel->commander().received());
+}
 
 class EcoSmartClimate : public Component, public Climate
 
 {
 public:
+  EcoSmartClimate(EcoSmartChannel *channel) : channel(channel) {}
+
   void setup() override
   {
-    ESP_LOGV(TAG, "setup()");
-
-    pinMode(OUTPUT_PIN, OUTPUT);
-    uint64_t init = INITIAL_COMMAND;
-    if (use_c)
-    {
-      init |= 1ULL << ECOSMART_C_BIT_SHIFT;
-    }
-    else
-    {
-      init &= ~(1ULL << ECOSMART_C_BIT_SHIFT);
-    }
-    cmd = init;
+    this->channel->command() = EcoSmartFrame(INITIAL_COMMAND).withCelsius(true);
     auto restore = this->restore_state_();
     if (restore.has_value())
     {
@@ -83,15 +87,13 @@ public:
     }
     if (isnan(this->target_temperature))
     {
-      this->target_temperature = ECOSMART_TEMP_MIN;
+      this->target_temperature = ECOSMART_TEMP_C_MIN;
     }
     this->publish_state();
   }
 
   ClimateTraits traits() override
   {
-    ESP_LOGV(TAG, "traits()");
-
     auto traits = climate::ClimateTraits();
     traits.set_supports_current_temperature(false);
     traits.set_supported_modes({
@@ -99,28 +101,27 @@ public:
         climate::CLIMATE_MODE_HEAT,
     });
     traits.set_supports_two_point_target_temperature(false);
-    traits.set_visual_min_temperature(ECOSMART_TEMP_MIN);
-    traits.set_visual_max_temperature(ECOSMART_TEMP_MAX);
+    traits.set_visual_min_temperature(ECOSMART_TEMP_C_MIN);
+    traits.set_visual_max_temperature(ECOSMART_TEMP_C_MAX);
     traits.set_visual_temperature_step(1);
     return traits;
   }
 
   void control(const ClimateCall &call) override
   {
-    ESP_LOGV(TAG, "control()");
-
     if (call.get_mode().has_value())
     {
       // User requested mode change
       ClimateMode mode = *call.get_mode();
+      EcoSmartFrame &cmd = this->channel->command();
 
       switch (mode)
       {
       case climate::CLIMATE_MODE_OFF:
-        cmd &= ~(1ULL << ECOSMART_ON_BIT_SHIFT);
+        cmd.setOn(false);
         break;
       case climate::CLIMATE_MODE_HEAT:
-        cmd |= 1ULL << ECOSMART_ON_BIT_SHIFT;
+        cmd.setOn(true);
         break;
       default:
         ESP_LOGE(TAG, "Climate mode not supported: %s", climate_mode_to_string(this->mode));
@@ -137,278 +138,270 @@ public:
     }
     if (call.get_target_temperature().has_value())
     {
-      // User requested target temperature change
-      float temp_c = clamp<float>(*call.get_target_temperature(), ECOSMART_TEMP_MIN, ECOSMART_TEMP_MAX);
-      float temp_f = ctof(temp_c);
-      setTempF(roundf(temp_f));
-      setTempC(roundf(temp_c));
-      this->target_temperature = temp_c;
+      // User requested target temperature change; the one float to integer
+      // step, everything after it is table lookups
+      int32_t tenths = static_cast<int32_t>(*call.get_target_temperature() * 10 + 0.5f);
+      EcoSmartSetpoint setpoint = ecoSmartSetpointC(tenths);
+      EcoSmartFrame &cmd = this->channel->command();
+      cmd.setTempF(setpoint.f);
+      cmd.setTempC(setpoint.c);
+      this->target_temperature = setpoint.c;
       sendCommand();
       // ...
     }
   }
 
-  void mark(unsigned int duration)
-  {
-    digitalWrite(OUTPUT_PIN, HIGH);
-    delayMicroseconds(duration);
-    digitalWrite(OUTPUT_PIN, LOW);
-  }
-
-  void space(unsigned int duration)
-  {
-    delayMicroseconds(duration);
-  }
-
-  void sendEcoSmart(uint64_t data, uint16_t nbits, uint16_t repeat)
-  {
-
-    for (uint16_t r = 0; r <= repeat; r++)
-    {
-      // Header
-      mark(ECOSMART_HDR_MARK);
-      space(ECOSMART_HDR_SPACE);
-      for (int32_t i = nbits; i > 0; i--)
-      {
-        switch ((data >> (i - 1)) & 1UL)
-        {
-        case 0:
-          mark(ECOSMART_BIT_MARK_LOW);
-          break;
-        case 1:
-          mark(ECOSMART_BIT_MARK_HIGH);
-          break;
-        }
-        space(ECOSMART_BIT_SPACE);
-      }
-
-      // wait this long between repeats
-      space(ECOSMART_RPT_SPACE - ECOSMART_BIT_SPACE);
-    }
-  }
-
-  float ftoc(float temp_f)
-  {
-    ESP_LOGV(TAG, "ftoc()");
-
-    auto temp = (temp_f - 32) / 1.8;
-    return static_cast<float>(temp);
-  }
-
-  float ctof(float temp_c)
-  {
-    ESP_LOGV(TAG, "ctof()");
-
-    auto temp = (temp_c * 1.8) + 32;
-    return static_cast<float>(temp);
-  }
-
-  void setTempF(byte temp_f)
-  {
-    ESP_LOGV(TAG, "setTempF()");
-
-    cmd &= ~(0xFF << ECOSMART_TEMP_F_SHIFT);
-    cmd |= temp_f << ECOSMART_TEMP_F_SHIFT;
-  }
-
-  void setTempC(byte temp_c)
-  {
-    ESP_LOGV(TAG, "setTempC()");
-
-    cmd &= ~(0xFF << ECOSMART_TEMP_C_SHIFT);
-    cmd |= temp_c << ECOSMART_TEMP_C_SHIFT;
-  }
-
+  // Queue the channel's command; a mode and a temperature change in the same
+  // call, or a burst of slider moves, end up as a single frame.
   void sendCommand()
   {
-    ESP_LOGV(TAG, "Sending command: 0x0F%08X", cmd);
-
-    sendEcoSmart(cmd, 40, RPT_CODES);
+    this->channel->request(millis());
     this->publish_state();
   }
+
+protected:
+  EcoSmartChannel *channel;
 };
 
 class EcoSmart : public Component, CustomAPIDevice
 {
 public:
   BinarySensor *flow_sensor = new BinarySensor("Flow Sensor");
-  EcoSmartClimate *climate = new EcoSmartClimate();
-  EcoSmart() {}
+  // Diagnostics, updated every STATS_INTERVAL_MS
+  Sensor *decode_attempts_sensor = new Sensor("Decode Attempts");
+  Sensor *decoded_sensor = new Sensor("Frames Decoded");
+  Sensor *decode_failures_sensor = new Sensor("Decode Failures");
+  TextSensor *failure_reasons_sensor = new TextSensor("Decode Failure Reasons");
+  TextSensor *command_result_sensor = new TextSensor("Last Command Result");
+  Sensor *overflows_sensor = new Sensor("Frame Queue Overflows");
+  Sensor *tx_time_sensor = new Sensor("Transmit Start Time");
+  Sensor *airtime_sensor = new Sensor("Transmit Airtime");
+  Sensor *deferral_sensor = new Sensor("Worst Transmit Deferral");
+  Sensor *loop_time_sensor = new Sensor("Worst Loop Time");
+  // Hot-water usage, updated every USAGE_INTERVAL_MS
+  Sensor *draws_sensor = new Sensor("Draws");
+  Sensor *draw_time_sensor = new Sensor("Draw Time");
+  Sensor *longest_draw_sensor = new Sensor("Longest Draw");
+  Sensor *duty_cycle_sensor = new Sensor("Duty Cycle");
+  Sensor *draw_setpoint_sensor = new Sensor("Draw Setpoint");
+  EcoSmartClimate *climate;
+
+  // One component per heater, each on its own pair of pins.
+  EcoSmart(uint8_t rx_pin = RECV_PIN, uint8_t tx_pin = OUTPUT_PIN)
+      : channel(rx_pin, tx_pin, COMMAND_SETTLE_MS, RPT_CODES)
+  {
+    this->climate = new EcoSmartClimate(&this->channel);
+  }
 
   // float get_setup_priority() const { return setup_priority::HARDWARE; }
 
   void setup() override
   {
-    ESP_LOGV(TAG, "setup()");
-
-    irrecv.enableIRIn();
+    EcoSmartReceiver &receiver = this->channel.receiver();
+    receiver.decoder().setVoting(true);
+    receiver.decoder().setCalibration(true);
+    if (CAPTURE_PER_MINUTE > 0)
+    {
+      receiver.setCapture(&this->captures);
+    }
+    this->channel.commander().setConfirmation(CONFIRM_TIMEOUT_MS, CONFIRM_RETRIES);
+    scheduler.setMaxDefer(TX_MAX_DEFER_MS);
+    this->slot = scheduler.channels();
+    if (!scheduler.add(&this->channel))
+    {
+      ESP_LOGE(TAG, "At most %u EcoSmart heaters are supported", ECOSMART_MAX_CHANNELS);
+      this->mark_failed();
+      return;
+    }
     climate->setup();
   }
 
   void loop() override
   {
-    if (irrecv.decode(&results))
-    {
+    uint32_t loop_start = micros();
+    transmitCommands();
+    reportDelivery();
+    publishState();
 
-      // Blank line between entries
-      ESP_LOGV(TAG, "Attempting EcoSmart decode");
-      if (results.decode_type == UNKNOWN && decodeEcoSmart(&results))
-      {
-        ESP_LOGV(TAG, "*** EcoSmart data found ***");
-        processData(results.value);
-      }
-      else
-      {
-        ESP_LOGV(TAG, "EcoSmart decode FAILED");
-
-        if (results.overflow)
-        {
-          ESP_LOGW(TAG, "IR code is too big for buffer (>= %d). "
-                        "This result shouldn't be trusted until this is resolved. "
-                        "Edit & increase CAPTURE_BUFFER_SIZE.\n",
-                   CAPTURE_BUFFER_SIZE);
-        }
-
-        // Display the basic output of what we found.
-        ESP_LOGVV(TAG, "%s", resultToHumanReadableBasic(&results).c_str());
-        yield(); // Feed the WDT as the text output can take a while to print.
-
-        // Display the library version the message was captured with.
-        ESP_LOGVV(TAG, "Library version: %s", _IRREMOTEESP8266_VERSION_);
-
-        // Output RAW timing info of the result.
-        ESP_LOGVV(TAG, "%s", resultToTimingInfo(&results).c_str());
-        yield(); // Feed the WDT (again)
-
-        // Output the results as source code
-        ESP_LOGVV(TAG, "%s", resultToSourceCode(&results).c_str());
-        yield(); // Feed the WDT (again)
-      }
-    }
-  };
+    EcoSmartReceiver &receiver = this->channel.receiver();
 
-  bool decodeEcoSmart(decode_results *results)
-  {
-    ESP_LOGV(TAG, "decodeEcoSmart()");
+    EcoSmartFrameRecord frame;
+    while (receiver.read(&frame))
+    {
+      ESP_LOGV(TAG, "*** EcoSmart data found at %u us (confidence %u%%) ***", frame.micros, frame.confidence);
+      processData(frame.frame);
+    }
 
-    uint64_t data = 0;
-    uint16_t offset = OFFSET_START;
+    uint32_t failures = receiver.decoder().failures();
+    if (failures != this->last_failures)
+    {
+      this->last_failures = failures;
+      ESP_LOGV(TAG, "EcoSmart decode FAILED, total failures: %u", failures);
+    }
+    writeCapture();
 
-    if (results->rawlen < 82)
+    uint32_t overflows = receiver.overflows();
+    if (overflows != this->last_overflows)
     {
-      return false; // Not enough entries to be EcoSmart.
+      this->last_overflows = overflows;
+      ESP_LOGW(TAG, "EcoSmart frame queue overflowed, frames dropped: %u", overflows);
     }
 
-    // Calc the maximum size in bits the message can be or that we can accept.
-    int maxBitSize = std::min((uint16_t)(results->rawlen / 2) - 1,
-                              (uint16_t)sizeof(data) * 8);
+    publishStats();
+    publishUsage();
+    this->loop_stats.add(micros() - loop_start);
+  };
 
-    // Header decode
-    if (!irrecv.matchMark(results->rawbuf[offset], ECOSMART_HDR_MARK))
+  // Decoder counters are totals since boot; times are the worst (and for
+  // transmit the mean) over the last interval, in us.
+  void publishStats()
+  {
+    if (millis() - this->last_stats < STATS_INTERVAL_MS)
     {
-      ESP_LOGV(TAG, "FALSE due to not matchMark on ECOSMART_HDR_MARK");
-      return false;
+      return;
     }
-
-    if (!irrecv.matchSpace(results->rawbuf[++offset], ECOSMART_HDR_SPACE))
+    this->last_stats = millis();
+
+    const EcoSmartDecoder &decoder = this->channel.receiver().decoder();
+    decode_attempts_sensor->publish_state(decoder.attempts());
+    decoded_sensor->publish_state(decoder.decoded());
+    decode_failures_sensor->publish_state(decoder.failures());
+    std::string reasons;
+    for (uint8_t i = 0; i < ECOSMART_FAIL_REASONS; i++)
     {
-      ESP_LOGV(TAG, "FALSE due to not matchMark on ECOSMART_HDR_SPACE");
-      return false;
+      char reason[24];
+      snprintf(reason, sizeof(reason), "%s%s=%u", i ? " " : "", ecoSmartFailureName(i),
+               decoder.failures(static_cast<EcoSmartDecodeFailure>(i)));
+      reasons += reason;
     }
-
-    // Data decode
-    uint16_t actualBits;
-    for (actualBits = 0; actualBits < maxBitSize; actualBits++)
+    failure_reasons_sensor->publish_state(reasons);
+    overflows_sensor->publish_state(this->channel.receiver().overflows());
+    EcoSmartHistogram &tx_stats = txStats[this->slot];
+    EcoSmartHistogram &defer_stats = deferStats[this->slot];
+    if (tx_stats.count() != 0)
     {
-      data <<= 1;
-
-      offset++;
-      if (irrecv.matchMark(results->rawbuf[offset], ECOSMART_BIT_MARK_LOW))
-      {
-        ESP_LOGVV(TAG, "offset = %i, data += 0", offset);
-        data += 0;
-      }
-      else if (irrecv.matchMark(results->rawbuf[offset], ECOSMART_BIT_MARK_HIGH))
-      {
-        ESP_LOGVV(TAG, "offset = %i, data += 1", offset);
-        data += 1;
-      }
-      else
-      {
-        return false;
-      }
-
-      offset++;
-      if (actualBits + 1 >= 40 && offset + 1 >= results->rawlen)
-      {
-        ESP_LOGVV(TAG, "Breaking due to 40 bits found...");
-        actualBits++;
-        break;
-      }
-      else if (irrecv.matchSpace(results->rawbuf[offset], ECOSMART_RPT_SPACE))
-      {
-        ESP_LOGVV(TAG, "Resetting due to repeat...");
-        data = 0;
-        actualBits = 0;
-        if (!irrecv.matchMark(results->rawbuf[offset + 1], ECOSMART_HDR_MARK))
-        {
-          ESP_LOGV(TAG, "FALSE due to not matchMark on ECOSMART_HDR_MARK after ECOSMART_RPT_SPACE");
-          return false;
-        }
-        if (!irrecv.matchSpace(results->rawbuf[offset + 2], ECOSMART_HDR_SPACE))
-        {
-          ESP_LOGV(TAG, "FALSE due to not matchMark on ECOSMART_HDR_SPACE after ECOSMART_RPT_SPACE");
-          return false;
-        }
-        offset += 2;
-      }
-      else if (!irrecv.matchSpace(results->rawbuf[offset], ECOSMART_BIT_SPACE))
-      {
-        ESP_LOGV(TAG, "FALSE due to not matchSpace on ECOSMART_BIT_SPACE after mark");
-        return false;
-      }
+      tx_time_sensor->publish_state(tx_stats.mean());
+    }
+    airtime_sensor->publish_state(scheduler.transmitter().airtimeUs());
+    if (defer_stats.count() != 0)
+    {
+      deferral_sensor->publish_state(defer_stats.max());
+    }
+    loop_time_sensor->publish_state(this->loop_stats.max());
+    ESP_LOGD(TAG, "Loop time over the last interval: mean %u us, p99 %u us, max %u us", this->loop_stats.mean(),
+             this->loop_stats.percentile(99), this->loop_stats.max());
+    EcoSmartTiming timing = decoder.timing();
+    ESP_LOGD(TAG, "Learned timing from %u frames: header %u/%u us, bits %u/%u/%u us, repeat space %u us",
+             decoder.calibrations(), timing.hdrMark, timing.hdrSpace, timing.bitMarkHigh, timing.bitMarkLow,
+             timing.bitSpace, timing.rptSpace);
+    if (TX_LEARNED_TIMING && decoder.calibrations() >= TX_LEARNED_TIMING_FRAMES)
+    {
+      this->channel.setTiming(decoder.transmitTiming());
     }
 
-    // Success
-    results->value = data;
-    // results->decode_type = UNKNOWN;
-    results->bits = actualBits;
-    results->address = 0;
-    results->command = 0;
-    return true;
+    this->loop_stats.reset();
+    tx_stats.reset();
+    defer_stats.reset();
   }
 
-  void processData(uint64_t data)
+  // The climate shows a command as soon as it is made; if the heater never
+  // confirms it, put back the state the heater last reported.
+  void reportDelivery()
   {
-    ESP_LOGV(TAG, "processData()");
-
-    cmd = data;
-
-    stateOn = ((cmd >> ECOSMART_ON_BIT_SHIFT) & 1U) == 1;
-    use_c = ((cmd >> ECOSMART_C_BIT_SHIFT) & 1U) == 1;
-    stateFlow = ((cmd >> ECOSMART_FLOW_BIT_SHIFT) & 1U) == 1;
-
-    climate->target_temperature = lroundf(use_c ? getTempC() : getTempF());
-    climate->mode = stateOn ? climate::CLIMATE_MODE_HEAT : climate::CLIMATE_MODE_OFF;
-    climate->publish_state();
+    EcoSmartCommander &commander = this->channel.commander();
+    EcoSmartDelivery outcome;
+    if (!commander.finished(millis(), &outcome))
+    {
+      return;
+    }
+    char result[48];
+    snprintf(result, sizeof(result), "%s (%u sent, %u ms)", ecoSmartDeliveryName(outcome), commander.attempts(),
+             commander.latencyMs());
+    command_result_sensor->publish_state(result);
+    if (outcome == ECOSMART_FAILED)
+    {
+      ESP_LOGW(TAG, "Command 0x0F%08X not confirmed by the heater", static_cast<uint32_t>(commander.target().raw()));
+      this->publisher.invalidate();
+    }
+  }
 
-    flow_sensor->publish_state(stateFlow);
+  // Log one pending capture of a failed decode for tools/ecosmart_capture.cpp.
+  void writeCapture()
+  {
+    EcoSmartCapture capture;
+    if (!this->captures.read(&capture))
+    {
+      return;
+    }
+    uint8_t record[ECOSMART_CAPTURE_MAX_BYTES];
+    char text[ECOSMART_CAPTURE_MAX_TEXT];
+    ecoSmartBase64(record, ecoSmartCaptureEncode(capture, record), text);
+    ESP_LOGD(TAG, "%s%s", ECOSMART_CAPTURE_PREFIX, text);
   }
 
-  byte getTempF()
+  // Summarise the interval just closed.
+  void publishUsage()
   {
-    ESP_LOGV(TAG, "getTempF()");
+    if (!this->usage.due(millis()))
+    {
+      return;
+    }
+    const EcoSmartUsageSummary &summary = this->usage.summary();
+    draws_sensor->publish_state(summary.draws);
+    draw_time_sensor->publish_state(summary.drawMs / 1000.0f);
+    longest_draw_sensor->publish_state(summary.longestMs / 1000.0f);
+    duty_cycle_sensor->publish_state(summary.dutyPermille / 10.0f);
+    if (summary.drawMs != 0)
+    {
+      draw_setpoint_sensor->publish_state(summary.setpointMean);
+    }
+  }
 
-    auto temp_f = static_cast<byte>((cmd >> ECOSMART_TEMP_F_SHIFT) & 0xFF);
-    return temp_f;
+  void processData(uint64_t data)
+  {
+    EcoSmartFrame cmd(data);
+    this->channel.observe(cmd, millis());
+
+    EcoSmartState state = {cmd.on(), cmd.flow(), cmd.celsius() ? cmd.tempC() : cmd.tempF()};
+    this->publisher.update(state);
+    // Draw Setpoint is published in °C, like the climate, whatever the heater displays
+    this->usage.update(state.flow, cmd.tempC(), millis());
+    publishState();
   }
 
-  byte getTempC()
+  // Publish only what changed since it was last published, at most once per
+  // STATE_MIN_INTERVAL_MS.
+  void publishState()
   {
-    ESP_LOGV(TAG, "getTempC()");
+    uint8_t fields = this->publisher.due(millis());
+    if (fields == 0)
+    {
+      return;
+    }
 
-    auto temp_c = static_cast<byte>((cmd >> ECOSMART_TEMP_C_SHIFT) & 0xFF);
-    return temp_c;
+    const EcoSmartState &state = this->publisher.state();
+    ESP_LOGD(TAG, "Publishing state fields 0x%x (%u suppressed so far)", fields, this->publisher.suppressed());
+
+    if (fields & (ECOSMART_FIELD_MODE | ECOSMART_FIELD_TEMPERATURE))
+    {
+      climate->target_temperature = state.temperature;
+      climate->mode = state.on ? climate::CLIMATE_MODE_HEAT : climate::CLIMATE_MODE_OFF;
+      climate->publish_state();
+    }
+    if (fields & ECOSMART_FIELD_FLOW)
+    {
+      flow_sensor->publish_state(state.flow);
+    }
   }
-};
 
+protected:
+  EcoSmartChannel channel;
+  uint8_t slot = 0; // this heater's index in the scheduler
+  EcoSmartPublisher publisher{STATE_MIN_INTERVAL_MS, STATE_REFRESH_INTERVAL_MS};
+  uint32_t last_failures = 0;
+  uint32_t last_overflows = 0;
+  EcoSmartHistogram loop_stats; // this component's loop()
+  uint32_t last_stats = 0;
+  EcoSmartUsage usage{USAGE_INTERVAL_MS};
+  EcoSmartCaptureRecorder captures{CAPTURE_SAMPLE_EVERY, CAPTURE_PER_MINUTE};
+};
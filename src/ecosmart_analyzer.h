@@ -0,0 +1,173 @@
+//
+// Per-bit statistics over decoded frames, for working out the unknown bits.
+//
+// Only the on, °C and flow bits of byte 3 and the two setpoint bytes are
+// understood; bytes 1 and 2 and the rest of byte 3 are not. Instead of keeping
+// raw captures, EcoSmartBitAnalyzer folds every decoded frame into a fixed set
+// of counters per bit: how often it is set, how often it flips, how often it is
+// set together with each known flag, and how often it flips in the same frame
+// as a known field changes. A bit that always flips with the setpoint, or is
+// only ever set while water flows, stands out after a few days of traffic.
+//
+// Usage:
+//   analyzer.add(frame);                                          // every frame
+//   size_t len = analyzer.report(2, message, sizeof(message));    // byte 3
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_ANALYZER_H
+#define ECOSMART_NODEMCU_ECOSMART_ANALYZER_H
+
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "ecosmart_frame.h"
+
+
+// Known fields bits are compared against. The setpoint is two whole bytes, so
+// only its changes are counted.
+enum EcoSmartKnownField : uint8_t {
+    ECOSMART_KNOWN_ON,
+    ECOSMART_KNOWN_CELSIUS,
+    ECOSMART_KNOWN_FLOW,
+    ECOSMART_KNOWN_SETPOINT,
+    ECOSMART_KNOWN_FIELDS,
+};
+
+#define ECOSMART_KNOWN_FLAGS          3U    // the fields above that are single bits
+
+
+struct EcoSmartBitStats {
+    uint32_t ones;                                  // frames with the bit set
+    uint32_t transitions;                           // frames where it differs from the previous one
+    uint32_t together[ECOSMART_KNOWN_FLAGS];        // frames with the bit and the flag both set
+    uint32_t changedWith[ECOSMART_KNOWN_FIELDS];    // transitions in a frame where the field changed
+};
+
+
+class EcoSmartBitAnalyzer {
+public:
+    // Fold in one decoded frame.
+    void add(const EcoSmartFrame &frame) {
+        bool flags[ECOSMART_KNOWN_FLAGS] = {frame.on(), frame.celsius(), frame.flow()};
+        bool changed[ECOSMART_KNOWN_FIELDS] = {};
+        uint64_t diff = 0;
+        if (_frames != 0) {
+            diff = frame.raw() ^ _last.raw();
+            changed[ECOSMART_KNOWN_ON] = frame.on() != _last.on();
+            changed[ECOSMART_KNOWN_CELSIUS] = frame.celsius() != _last.celsius();
+            changed[ECOSMART_KNOWN_FLOW] = frame.flow() != _last.flow();
+            changed[ECOSMART_KNOWN_SETPOINT] = frame.tempF() != _last.tempF() || frame.tempC() != _last.tempC();
+        }
+        for (uint8_t f = 0; f < ECOSMART_KNOWN_FIELDS; f++) {
+            if (f < ECOSMART_KNOWN_FLAGS && flags[f]) _flags[f]++;
+            if (changed[f]) _changes[f]++;
+        }
+
+        // only the bits that are set or flipped have counters to bump
+        for (uint64_t bits = frame.raw() | diff; bits != 0; bits &= bits - 1) {
+            uint8_t i = static_cast<uint8_t>(__builtin_ctzll(bits));
+            EcoSmartBitStats &stats = _bits[i];
+            if ((frame.raw() >> i) & 1) {
+                stats.ones++;
+                for (uint8_t f = 0; f < ECOSMART_KNOWN_FLAGS; f++) {
+                    if (flags[f]) stats.together[f]++;
+                }
+            }
+            if ((diff >> i) & 1) {
+                stats.transitions++;
+                for (uint8_t f = 0; f < ECOSMART_KNOWN_FIELDS; f++) {
+                    if (changed[f]) stats.changedWith[f]++;
+                }
+            }
+        }
+
+        _last = frame;
+        _frames++;
+    }
+
+    uint32_t frames() const {
+        return _frames;
+    }
+
+    // Counters for bit i, numbered as in EcoSmartFrame (0 is the lowest bit
+    // of the last byte).
+    const EcoSmartBitStats &bit(uint8_t i) const {
+        return _bits[i < ECOSMART_BITS ? i : 0];
+    }
+
+    // Frames with a known flag set.
+    uint32_t flagged(EcoSmartKnownField field) const {
+        return field < ECOSMART_KNOWN_FLAGS ? _flags[field] : 0;
+    }
+
+    // Frames in which a known field changed.
+    uint32_t changes(EcoSmartKnownField field) const {
+        return field < ECOSMART_KNOWN_FIELDS ? _changes[field] : 0;
+    }
+
+    // Bits that have never flipped.
+    uint64_t constantMask() const {
+        uint64_t mask = 0;
+        for (uint8_t i = 0; i < ECOSMART_BITS; i++) {
+            if (_bits[i].transitions == 0) mask |= 1ULL << i;
+        }
+        return mask;
+    }
+
+    // Write the counters for one frame byte (0 to ECOSMART_FRAME_BYTES - 1) as
+    // JSON, numbering the byte from 1 as the README does:
+    //   {"frames":N,"byte":3,"last":"18","flags":[on,c,flow],"changes":[on,c,flow,setpoint],
+    //    "bits":[[ones,transitions,with on,with c,with flow,flips with on,c,flow,setpoint],...]}
+    // "bits" runs from the byte's 0x80 bit down to its 0x01 bit.
+    //
+    // Returns:
+    //   The length of the whole report, as snprintf(); size or more means it
+    //   did not fit.
+    size_t report(uint8_t byte, char *out, size_t size) const {
+        if (byte >= ECOSMART_FRAME_BYTES) {
+            return 0;
+        }
+        size_t len = 0;
+        len += append(out, size, len, "{\"frames\":%u,\"byte\":%u,\"last\":\"%02X\",\"flags\":[%u,%u,%u],"
+                      "\"changes\":[%u,%u,%u,%u],\"bits\":[", _frames, byte + 1U, _last.byteAt(byte),
+                      _flags[0], _flags[1], _flags[2], _changes[0], _changes[1], _changes[2], _changes[3]);
+        for (uint8_t b = 0; b < 8; b++) {
+            const EcoSmartBitStats &s = _bits[8 * (ECOSMART_FRAME_BYTES - 1 - byte) + 7 - b];
+            len += append(out, size, len, "%s[%u,%u,%u,%u,%u,%u,%u,%u,%u]", b ? "," : "", s.ones,
+                          s.transitions, s.together[0], s.together[1], s.together[2], s.changedWith[0],
+                          s.changedWith[1], s.changedWith[2], s.changedWith[3]);
+        }
+        len += append(out, size, len, "]}");
+        return len;
+    }
+
+    void reset() {
+        memset(_bits, 0, sizeof(_bits));
+        memset(_flags, 0, sizeof(_flags));
+        memset(_changes, 0, sizeof(_changes));
+        _last = EcoSmartFrame();
+        _frames = 0;
+    }
+
+private:
+    // snprintf at out + len, without running past size.
+    static size_t append(char *out, size_t size, size_t len, const char *format, ...)
+            __attribute__((format(printf, 4, 5))) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(len < size ? out + len : nullptr, len < size ? size - len : 0, format, args);
+        va_end(args);
+        return n < 0 ? 0 : static_cast<size_t>(n);
+    }
+
+    EcoSmartBitStats _bits[ECOSMART_BITS] = {};
+    uint32_t _flags[ECOSMART_KNOWN_FLAGS] = {};
+    uint32_t _changes[ECOSMART_KNOWN_FIELDS] = {};
+    EcoSmartFrame _last;
+    uint32_t _frames = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_ANALYZER_H
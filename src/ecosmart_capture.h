@@ -0,0 +1,201 @@
+//
+// Raw captures of failed decodes, for debugging the receiver in the field.
+//
+// EcoSmartCaptureRecorder remembers the durations fed to the decoder since
+// the last gap. When a frame is abandoned it keeps a copy, subject to
+// sampling and a per-minute limit, so a noisy line cannot flood the log.
+// loop() then writes each capture as one compact length-prefixed binary
+// record, base64 encoded on a line starting with ECOSMART_CAPTURE_PREFIX so
+// it can share the serial console with normal logging:
+//
+//   uint16  length of the rest of the record
+//   uint8   format version (ECOSMART_CAPTURE_VERSION)
+//   uint8   failure reason (EcoSmartDecodeFailure)
+//   uint32  micros() when the failing duration ended
+//   uint8   number of durations
+//   uint16  durations in us, oldest first, the last one is where decoding
+//           failed; a leading 65535 is the gap before the burst
+//
+// All integers are little-endian. tools/ecosmart_capture.cpp turns a log
+// containing such lines back into readable timing tables.
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_CAPTURE_H
+#define ECOSMART_NODEMCU_ECOSMART_CAPTURE_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ecosmart_compat.h"
+#include "ecosmart_queue.h"
+
+
+#define ECOSMART_CAPTURE_EDGES      96U     // durations kept per capture, a full frame is 82
+#define ECOSMART_CAPTURE_QUEUE       2U     // captures waiting for loop(), power of two
+#define ECOSMART_CAPTURE_VERSION     1U
+#define ECOSMART_CAPTURE_PREFIX     "ECSC:"
+#define ECOSMART_CAPTURE_MAX_BYTES  (2 + 1 + 1 + 4 + 1 + 2 * ECOSMART_CAPTURE_EDGES)
+#define ECOSMART_CAPTURE_MAX_TEXT   ((ECOSMART_CAPTURE_MAX_BYTES + 2) / 3 * 4 + 1)
+
+
+struct EcoSmartCapture {
+    uint32_t micros;
+    uint8_t reason;
+    uint8_t count;
+    uint16_t durations[ECOSMART_CAPTURE_EDGES];
+};
+
+
+class EcoSmartCaptureRecorder {
+public:
+    // Args:
+    //   sampleEvery: Keep one in this many failures, 1 to keep them all.
+    //   perMinute: Keep at most this many captures a minute.
+    EcoSmartCaptureRecorder(uint8_t sampleEvery, uint8_t perMinute)
+            : _sampleEvery(sampleEvery != 0 ? sampleEvery : 1), _perMinute(perMinute) {}
+
+    // A gap of silence: start a new capture, beginning with the gap.
+    void IRAM_ATTR gap() {
+        _count = 0;
+        edge(UINT16_MAX);
+    }
+
+    // A duration that was fed to the decoder.
+    void IRAM_ATTR edge(uint32_t us) {
+        _ring[_next] = us > UINT16_MAX ? UINT16_MAX : static_cast<uint16_t>(us);
+        _next = (_next + 1) % ECOSMART_CAPTURE_EDGES;
+        if (_count < ECOSMART_CAPTURE_EDGES) {
+            _count++;
+        }
+    }
+
+    // The last duration made the decoder abandon a frame.
+    void IRAM_ATTR failed(uint8_t reason, uint32_t now) {
+        if (++_seen < _sampleEvery) {
+            _skipped++;
+            return;
+        }
+        _seen = 0;
+        if (now - _windowStart >= 60000000UL) {
+            _windowStart = now;
+            _inWindow = 0;
+        }
+        if (_inWindow >= _perMinute) {
+            _limited++;
+            return;
+        }
+        _inWindow++;
+
+        EcoSmartCapture capture;
+        capture.micros = now;
+        capture.reason = reason;
+        capture.count = _count;
+        uint8_t first = (_next + ECOSMART_CAPTURE_EDGES - _count) % ECOSMART_CAPTURE_EDGES;
+        for (uint8_t i = 0; i < _count; i++) {
+            capture.durations[i] = _ring[(first + i) % ECOSMART_CAPTURE_EDGES];
+        }
+        _captures.push(capture);
+    }
+
+    // Take the oldest capture. Returns false if there is none.
+    bool read(EcoSmartCapture *capture) {
+        return _captures.pop(capture);
+    }
+
+    // Failures passed over by sampling.
+    uint32_t skipped() const {
+        return _skipped;
+    }
+
+    // Failures passed over because the per-minute limit was reached.
+    uint32_t limited() const {
+        return _limited;
+    }
+
+    // Captures dropped because loop() had not written the previous ones yet.
+    uint32_t overflows() const {
+        return _captures.overflows();
+    }
+
+private:
+    uint8_t _sampleEvery;
+    uint8_t _perMinute;
+    uint16_t _ring[ECOSMART_CAPTURE_EDGES] = {};
+    uint8_t _next = 0;
+    uint8_t _count = 0;
+    uint8_t _seen = 0;
+    uint8_t _inWindow = 0;
+    uint32_t _windowStart = 0;
+    volatile uint32_t _skipped = 0;
+    volatile uint32_t _limited = 0;
+    EcoSmartQueue<EcoSmartCapture, ECOSMART_CAPTURE_QUEUE> _captures;
+};
+
+
+// Write capture as a binary record (see the top of this file).
+//
+// Returns:
+//   The length of the record, at most ECOSMART_CAPTURE_MAX_BYTES.
+inline size_t ecoSmartCaptureEncode(const EcoSmartCapture &capture, uint8_t *out) {
+    size_t len = 2;
+    out[len++] = ECOSMART_CAPTURE_VERSION;
+    out[len++] = capture.reason;
+    for (uint8_t i = 0; i < 4; i++) {
+        out[len++] = static_cast<uint8_t>(capture.micros >> (8 * i));
+    }
+    out[len++] = capture.count;
+    for (uint8_t i = 0; i < capture.count; i++) {
+        out[len++] = static_cast<uint8_t>(capture.durations[i]);
+        out[len++] = static_cast<uint8_t>(capture.durations[i] >> 8);
+    }
+    out[0] = static_cast<uint8_t>(len - 2);
+    out[1] = static_cast<uint8_t>((len - 2) >> 8);
+    return len;
+}
+
+// Read a binary record back.
+//
+// Returns:
+//   The length of the record, or 0 if it is truncated or malformed.
+inline size_t ecoSmartCaptureDecode(const uint8_t *in, size_t len, EcoSmartCapture *capture) {
+    if (len < 9) {
+        return 0;
+    }
+    size_t body = in[0] | static_cast<size_t>(in[1]) << 8;
+    if (body + 2 > len || body < 7 || in[2] != ECOSMART_CAPTURE_VERSION) {
+        return 0;
+    }
+    uint8_t count = in[8];
+    if (count > ECOSMART_CAPTURE_EDGES || body != 7 + 2U * count) {
+        return 0;
+    }
+    capture->reason = in[3];
+    capture->micros = in[4] | static_cast<uint32_t>(in[5]) << 8 | static_cast<uint32_t>(in[6]) << 16 |
+                      static_cast<uint32_t>(in[7]) << 24;
+    capture->count = count;
+    for (uint8_t i = 0; i < count; i++) {
+        capture->durations[i] = static_cast<uint16_t>(in[9 + 2 * i] | in[10 + 2 * i] << 8);
+    }
+    return body + 2;
+}
+
+// Base64 encode len bytes into out, which must hold (len + 2) / 3 * 4 + 1
+// characters. Returns the length of the NUL-terminated text.
+inline size_t ecoSmartBase64(const uint8_t *in, size_t len, char *out) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t chunk = static_cast<uint32_t>(in[i]) << 16;
+        if (i + 1 < len) chunk |= static_cast<uint32_t>(in[i + 1]) << 8;
+        if (i + 2 < len) chunk |= in[i + 2];
+        out[n++] = alphabet[(chunk >> 18) & 0x3F];
+        out[n++] = alphabet[(chunk >> 12) & 0x3F];
+        out[n++] = i + 1 < len ? alphabet[(chunk >> 6) & 0x3F] : '=';
+        out[n++] = i + 2 < len ? alphabet[chunk & 0x3F] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_CAPTURE_H
@@ -0,0 +1,253 @@
+//
+// One heater per EcoSmartChannel, several heaters per board.
+//
+// A channel bundles everything that belongs to one heater: its receive and
+// transmit pins, its receiver and decoder, the command being built and the
+// commander that decides when to send it. The ESP8266 has one hardware timer
+// to spare, so a single EcoSmartScheduler owns the transmitter and starts the
+// channels' transmissions one at a time, round-robin, while every channel
+// keeps receiving on its own pin interrupt.
+//
+// A due command is held back while its heater is talking, or when the
+// heater's next burst would start before the command is through (see
+// EcoSmartLineMonitor), but never for longer than the maximum deferral.
+//
+// Usage:
+//   EcoSmartChannel upstairs(4, 12, COMMAND_SETTLE_MS, RPT_CODES);
+//   EcoSmartChannel downstairs(5, 14, COMMAND_SETTLE_MS, RPT_CODES);
+//   EcoSmartScheduler scheduler;
+//
+//   scheduler.add(&upstairs); scheduler.add(&downstairs);     // setup()
+//   upstairs.observe(frame, millis());                         // every decoded frame
+//   upstairs.command().setTempC(45); upstairs.request(millis());
+//   scheduler.loop(millis());                                  // loop()
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_CHANNEL_H
+#define ECOSMART_NODEMCU_ECOSMART_CHANNEL_H
+
+
+#include <stdint.h>
+#include "ecosmart_compat.h"
+#include "ecosmart_frame.h"
+#include "ecosmart_commands.h"
+#include "ecosmart_decoder.h"
+#include "ecosmart_tx.h"
+
+
+#define ECOSMART_MAX_CHANNELS        4U     // heaters one scheduler can drive
+#define ECOSMART_MAX_DEFER_MS     1000U     // longest a command waits for its heater to fall quiet
+
+
+class EcoSmartChannel {
+public:
+    // Args:
+    //   rxPin: Pin connected to the heater's data out.
+    //   txPin: Pin connected to the heater's data in.
+    //   settleMs: Commands are merged until none has arrived for this long.
+    //   repeats: Number of times each command frame is repeated.
+    EcoSmartChannel(uint8_t rxPin, uint8_t txPin, uint32_t settleMs, uint16_t repeats)
+            : _rxPin(rxPin), _txPin(txPin), _repeats(repeats), _commander(settleMs) {}
+
+    // Start receiving and drive the transmit pin low. Called by
+    // EcoSmartScheduler::add().
+    void begin() {
+        pinMode(_txPin, OUTPUT);
+        digitalWrite(_txPin, LOW);
+#ifdef ARDUINO
+        _receiver.begin(_rxPin);
+#endif
+    }
+
+    // The command being built for this heater. While nothing is pending or
+    // awaiting confirmation it follows the heater's reports; otherwise it
+    // keeps the requested state, so edits build on what was asked for rather
+    // than on a report that predates it.
+    EcoSmartFrame &command() {
+        return _command;
+    }
+
+    // A frame decoded from this heater.
+    void observe(const EcoSmartFrame &frame, uint32_t nowMs) {
+        _reported = frame;
+        _commander.observe(frame, nowMs);
+        if (!_commander.pending() && !_commander.awaiting()) {
+            _command = frame;
+        }
+    }
+
+    // The heater's last decoded frame, or the last one passed to observe().
+    const EcoSmartFrame &reported() const {
+        return _reported;
+    }
+
+    // Queue command() for transmission.
+    void request(uint32_t nowMs) {
+        _commander.request(_command, nowMs);
+    }
+
+    EcoSmartReceiver &receiver() {
+        return _receiver;
+    }
+
+    EcoSmartCommander &commander() {
+        return _commander;
+    }
+
+    // Transmit with these widths, e.g. the ones receiver().decoder() learned.
+    void setTiming(const EcoSmartTiming &timing) {
+        _timing = timing;
+    }
+
+    const EcoSmartTiming &timing() const {
+        return _timing;
+    }
+
+    uint8_t rxPin() const {
+        return _rxPin;
+    }
+
+    uint8_t txPin() const {
+        return _txPin;
+    }
+
+    uint16_t repeats() const {
+        return _repeats;
+    }
+
+private:
+    uint8_t _rxPin;
+    uint8_t _txPin;
+    uint16_t _repeats;
+    EcoSmartFrame _command;
+    EcoSmartFrame _reported;
+    EcoSmartReceiver _receiver;
+    EcoSmartCommander _commander;
+    EcoSmartTiming _timing = EcoSmartTiming::nominal();
+};
+
+
+class EcoSmartScheduler {
+public:
+    // Send a command after this long even if its heater has not fallen quiet.
+    void setMaxDefer(uint32_t ms) {
+        _maxDefer = ms;
+    }
+
+    // Register a channel (which must outlive the scheduler) and begin it.
+    // Returns false if ECOSMART_MAX_CHANNELS are already registered.
+    bool add(EcoSmartChannel *channel) {
+        if (_count >= ECOSMART_MAX_CHANNELS) {
+            return false;
+        }
+        if (_count == 0) {
+            _transmitter.begin(channel->txPin());
+        }
+        channel->begin();
+        _channels[_count++] = channel;
+        return true;
+    }
+
+    // Dispatch the transmitter's completion callback and, if the transmitter
+    // is free, start the next channel with a command due and a quiet line.
+    // Channels take turns so a busy heater cannot starve the others.
+    //
+    // Returns:
+    //   The channel whose transmission was started, or nullptr.
+    EcoSmartChannel *loop(uint32_t nowMs) {
+        _transmitter.loop();
+        if (_transmitter.busy()) {
+            return nullptr;
+        }
+        uint32_t nowUs = micros();
+        for (uint8_t n = 0; n < _count; n++) {
+            uint8_t i = (_next + n) % _count;
+            EcoSmartChannel *channel = _channels[i];
+            uint8_t bit = static_cast<uint8_t>(1U << i);
+            if (!channel->commander().due(nowMs)) {
+                _deferring &= static_cast<uint8_t>(~bit);
+                continue;
+            }
+            // a command that supersedes a held one gets its own deferral
+            uint32_t received = channel->commander().received();
+            if ((_deferring & bit) == 0 || _deferFor[i] != received) {
+                _deferring |= bit;
+                _deferSince[i] = nowMs;
+                _deferFor[i] = received;
+            }
+            uint32_t deferred = nowMs - _deferSince[i];
+            bool quiet = channel->receiver().line().waitUs(nowUs, airtimeUs(*channel)) == 0;
+            if (!quiet && deferred < _maxDefer) {
+                continue;
+            }
+
+            _transmitter.setPin(channel->txPin());
+            _transmitter.setTiming(channel->timing());
+            if (!_transmitter.send(channel->commander().target().raw(), ECOSMART_BITS, channel->repeats())) {
+                return nullptr;
+            }
+            channel->commander().sent(nowMs);
+            _deferring &= static_cast<uint8_t>(~bit);
+            _deferred = deferred;
+            if (!quiet) {
+                _forced++;
+            }
+            _next = (i + 1) % _count;
+            _current = channel;
+            return channel;
+        }
+        return nullptr;
+    }
+
+    // The channel of the transmission in progress (or the last one).
+    EcoSmartChannel *current() const {
+        return _current;
+    }
+
+    // How long the last transmission started was held back, in ms.
+    uint32_t deferredMs() const {
+        return _deferred;
+    }
+
+    // Transmissions started at the maximum deferral without a quiet line.
+    uint32_t forced() const {
+        return _forced;
+    }
+
+    EcoSmartTransmitter &transmitter() {
+        return _transmitter;
+    }
+
+    uint8_t channels() const {
+        return _count;
+    }
+
+    EcoSmartChannel *channel(uint8_t i) const {
+        return i < _count ? _channels[i] : nullptr;
+    }
+
+private:
+    // Longest a channel's burst can take: every bit a long mark.
+    static uint32_t airtimeUs(const EcoSmartChannel &channel) {
+        const EcoSmartTiming &timing = channel.timing();
+        uint16_t bitMark = timing.bitMarkHigh > timing.bitMarkLow ? timing.bitMarkHigh : timing.bitMarkLow;
+        uint32_t frame = timing.hdrMark + timing.hdrSpace +
+                         ECOSMART_BITS * static_cast<uint32_t>(bitMark + timing.bitSpace);
+        return (frame + timing.rptSpace) * (channel.repeats() + 1U);
+    }
+
+    EcoSmartTransmitter _transmitter;
+    EcoSmartChannel *_channels[ECOSMART_MAX_CHANNELS] = {};
+    uint8_t _count = 0;
+    uint8_t _next = 0;
+    EcoSmartChannel *_current = nullptr;
+    uint32_t _maxDefer = ECOSMART_MAX_DEFER_MS;
+    uint8_t _deferring = 0;     // one bit per channel with a due command held back
+    uint32_t _deferSince[ECOSMART_MAX_CHANNELS] = {};
+    uint32_t _deferFor[ECOSMART_MAX_CHANNELS] = {};    // commander().received() when the deferral began
+    uint32_t _deferred = 0;
+    uint32_t _forced = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_CHANNEL_H
@@ -0,0 +1,195 @@
+//
+// Coalescing command stage.
+//
+// Setpoint and mode requests are merged into one target frame and only the
+// latest target is transmitted, once no further request has arrived for a
+// short settle window. Dragging a slider therefore sends one frame instead of
+// dozens. Switching the heater off skips the window; changing the setpoint
+// while it is already off does not.
+//
+// With confirmation on, a transmitted target is not assumed to have arrived:
+// the commander watches the heater's own frames for one that reports the
+// target state, and sends the target again (waiting twice as long each time)
+// if none has within the timeout. Each command then ends up acknowledged on
+// the first frame, acknowledged after retries, or failed.
+//
+// Usage:
+//   commander.setConfirmation(CONFIRM_TIMEOUT_MS, CONFIRM_RETRIES);
+//   commander.request(cmd, millis());             // on every command
+//   if (commander.due(millis()) && transmitter.send(commander.target().raw(), ...)) {
+//       commander.sent(millis());
+//   }
+//   commander.observe(frame, millis());           // on every decoded frame
+//   if (commander.finished(millis(), &outcome)) { report outcome ... }
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_COMMANDS_H
+#define ECOSMART_NODEMCU_ECOSMART_COMMANDS_H
+
+
+#include <stdint.h>
+#include "ecosmart_frame.h"
+
+
+enum EcoSmartDelivery : uint8_t {
+    ECOSMART_ACKNOWLEDGED,      // confirmed after the first transmission
+    ECOSMART_RETRIED,           // confirmed after retransmitting
+    ECOSMART_FAILED,            // never confirmed
+    ECOSMART_DELIVERY_OUTCOMES,
+};
+
+inline const char *ecoSmartDeliveryName(uint8_t outcome) {
+    static const char *const names[] = {"acknowledged", "retried", "failed"};
+    return outcome < ECOSMART_DELIVERY_OUTCOMES ? names[outcome] : "unknown";
+}
+
+
+class EcoSmartCommander {
+public:
+    explicit EcoSmartCommander(uint32_t settleMs) : _settle(settleMs) {}
+
+    // Wait up to timeoutMs for the heater to confirm a transmitted target,
+    // doubling the wait for each of up to retries retransmissions. A timeout
+    // of 0 (the default) trusts every transmission.
+    void setConfirmation(uint32_t timeoutMs, uint8_t retries) {
+        _timeout = timeoutMs;
+        _retries = retries;
+    }
+
+    // Make target the state to transmit, replacing anything still pending or
+    // awaiting confirmation.
+    void request(const EcoSmartFrame &target, uint32_t nowMs) {
+        _received++;
+        // switching off should never wait for a slider to settle
+        _urgent = !target.on() && (_target.on() || _sentOn);
+        _target = target;
+        _lastRequest = nowMs;
+        _pending = true;
+        _awaiting = false;
+        _attempts = 0;
+    }
+
+    // True when the target should be transmitted now: it is pending and has
+    // settled, or it was transmitted and went unconfirmed with retries left.
+    bool due(uint32_t nowMs) const {
+        if (_awaiting) {
+            return _attempts <= _retries && expired(nowMs);
+        }
+        return _pending && (_urgent || nowMs - _lastRequest >= _settle);
+    }
+
+    // The latest requested state.
+    const EcoSmartFrame &target() const {
+        return _target;
+    }
+
+    // Call once the target has been handed to the transmitter.
+    void sent(uint32_t nowMs) {
+        _pending = false;
+        _urgent = false;
+        _sentOn = _target.on();
+        _sent++;
+        _attempts++;
+        _sentAt = nowMs;
+        if (_attempts == 1) {
+            _firstSentAt = nowMs;
+        }
+        if (_timeout != 0) {
+            _awaiting = true;
+        }
+    }
+
+    // A frame decoded from the heater. It confirms the target if it reports
+    // the same mode and, when on, the same setpoint.
+    void observe(const EcoSmartFrame &frame, uint32_t nowMs) {
+        if (!_awaiting || frame.on() != _target.on() ||
+            (_target.on() && (frame.tempF() != _target.tempF() || frame.tempC() != _target.tempC()))) {
+            return;
+        }
+        finish(_attempts > 1 ? ECOSMART_RETRIED : ECOSMART_ACKNOWLEDGED, nowMs);
+    }
+
+    // True once for each command that was confirmed or has failed, with the
+    // outcome; attempts() and latencyMs() then describe it.
+    bool finished(uint32_t nowMs, EcoSmartDelivery *outcome) {
+        if (_awaiting && _attempts > _retries && expired(nowMs)) {
+            finish(ECOSMART_FAILED, nowMs);
+        }
+        if (!_finished) {
+            return false;
+        }
+        _finished = false;
+        *outcome = _outcome;
+        return true;
+    }
+
+    bool pending() const {
+        return _pending;
+    }
+
+    // True while a transmitted target waits for confirmation.
+    bool awaiting() const {
+        return _awaiting;
+    }
+
+    // Transmissions of the last finished (or the current) command.
+    uint8_t attempts() const {
+        return _attempts;
+    }
+
+    // From the first transmission of the last finished command to its outcome.
+    uint32_t latencyMs() const {
+        return _latency;
+    }
+
+    // Number of commands with the given outcome.
+    uint32_t outcomes(EcoSmartDelivery outcome) const {
+        return outcome < ECOSMART_DELIVERY_OUTCOMES ? _outcomes[outcome] : 0;
+    }
+
+    // Number of commands requested.
+    uint32_t received() const {
+        return _received;
+    }
+
+    // Number of frames actually handed to the transmitter.
+    uint32_t framesSent() const {
+        return _sent;
+    }
+
+private:
+    bool expired(uint32_t nowMs) const {
+        return nowMs - _sentAt >= (_timeout << (_attempts - 1));
+    }
+
+    void finish(EcoSmartDelivery outcome, uint32_t nowMs) {
+        _awaiting = false;
+        _finished = true;
+        _outcome = outcome;
+        _outcomes[outcome]++;
+        _latency = nowMs - _firstSentAt;
+    }
+
+    uint32_t _settle;
+    EcoSmartFrame _target;
+    uint32_t _lastRequest = 0;
+    bool _pending = false;
+    bool _urgent = false;
+    bool _sentOn = true;        // the last transmitted target was on; assumed until one is sent
+    uint32_t _received = 0;
+    uint32_t _sent = 0;
+
+    uint32_t _timeout = 0;
+    uint8_t _retries = 0;
+    bool _awaiting = false;
+    uint8_t _attempts = 0;
+    uint32_t _sentAt = 0;
+    uint32_t _firstSentAt = 0;
+    bool _finished = false;
+    EcoSmartDelivery _outcome = ECOSMART_ACKNOWLEDGED;
+    uint32_t _latency = 0;
+    uint32_t _outcomes[ECOSMART_DELIVERY_OUTCOMES] = {};
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_COMMANDS_H
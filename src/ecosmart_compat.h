@@ -0,0 +1,78 @@
+//
+// Small portability layer so the EcoSmart protocol headers build both for the
+// ESP8266 and on a host machine.
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_COMPAT_H
+#define ECOSMART_NODEMCU_ECOSMART_COMPAT_H
+
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+
+#else  // ARDUINO
+
+// Thin stand-ins for the Arduino calls the protocol code uses, for the
+// [env:native] build. Pins are just remembered so host code can inspect them.
+#include <stdint.h>
+#include <chrono>
+
+#ifndef LOW
+#define LOW     0x0
+#define HIGH    0x1
+#define INPUT   0x0
+#define OUTPUT  0x1
+#endif
+
+inline uint8_t *ecoSmartHostPins() {
+    static uint8_t pins[32] = {};
+    return pins;
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+    (void) pin;
+    (void) mode;
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t level) {
+    ecoSmartHostPins()[pin & 31U] = level;
+}
+
+inline int digitalRead(uint8_t pin) {
+    return ecoSmartHostPins()[pin & 31U];
+}
+
+inline uint32_t micros() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+}
+
+inline uint32_t millis() {
+    return micros() / 1000U;
+}
+
+inline void delayMicroseconds(uint32_t us) {
+    uint32_t start = micros();
+    while (micros() - start < us) {
+    }
+}
+
+inline void yield() {
+}
+
+#endif  // ARDUINO
+
+// Interrupt handlers and everything they call must live in IRAM on the
+// ESP8266. Older cores only know the ICACHE_RAM_ATTR spelling.
+#ifndef IRAM_ATTR
+#ifdef ICACHE_RAM_ATTR
+#define IRAM_ATTR ICACHE_RAM_ATTR
+#else
+#define IRAM_ATTR
+#endif
+#endif
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_COMPAT_H
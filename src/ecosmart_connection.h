@@ -0,0 +1,180 @@
+//
+// Non-blocking Wi-Fi/MQTT connection manager.
+//
+// step() is called once per loop() and does at most one connection attempt,
+// so decoding, transmitting and OTA keep running while the network or broker
+// is down. Failed attempts back off exponentially with random jitter, so a
+// bank of devices does not hammer the broker in lock-step after an outage.
+//
+// The network specifics are supplied as hooks:
+//   wifiUp()      - is Wi-Fi associated?
+//   wifiBegin()   - (re)start association; must not block
+//   mqttUp()      - is the broker session alive?
+//   mqttConnect() - one connection attempt, true on success
+//   onConnected() - subscribe and publish a state snapshot
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_CONNECTION_H
+#define ECOSMART_NODEMCU_ECOSMART_CONNECTION_H
+
+
+#include <stdint.h>
+
+
+// Exponential backoff with jitter: the n-th consecutive failure waits a
+// random time between half and all of min(base * 2^n, max).
+class EcoSmartBackoff {
+public:
+    EcoSmartBackoff(uint32_t baseMs, uint32_t maxMs) : _base(baseMs), _max(maxMs) {}
+
+    void seed(uint32_t seed) {
+        _rng = seed != 0 ? seed : 1;
+    }
+
+    // True once the wait after the last failure is over.
+    bool ready(uint32_t nowMs) const {
+        return _failures == 0 || nowMs - _failedAt >= _wait;
+    }
+
+    void failed(uint32_t nowMs) {
+        uint32_t wait = _base;
+        for (uint8_t i = 0; i < _failures && wait < _max; i++) {
+            wait <<= 1;
+        }
+        if (wait > _max) {
+            wait = _max;
+        }
+        _wait = wait / 2 + next() % (wait / 2 + 1);
+        _failedAt = nowMs;
+        if (_failures < UINT8_MAX) {
+            _failures++;
+        }
+    }
+
+    void succeeded() {
+        _failures = 0;
+    }
+
+    uint8_t failures() const {
+        return _failures;
+    }
+
+    // How long the current wait is, for logging.
+    uint32_t waitMs() const {
+        return _failures == 0 ? 0 : _wait;
+    }
+
+private:
+    // xorshift32, plenty for spreading retries
+    uint32_t next() {
+        _rng ^= _rng << 13;
+        _rng ^= _rng >> 17;
+        _rng ^= _rng << 5;
+        return _rng;
+    }
+
+    uint32_t _base;
+    uint32_t _max;
+    uint32_t _wait = 0;
+    uint32_t _failedAt = 0;
+    uint8_t _failures = 0;
+    uint32_t _rng = 2463534242U;
+};
+
+
+struct EcoSmartConnectionHooks {
+    bool (*wifiUp)();
+    void (*wifiBegin)();
+    bool (*mqttUp)();
+    bool (*mqttConnect)();
+    void (*onConnected)();
+};
+
+
+class EcoSmartConnection {
+public:
+    enum State : uint8_t {
+        WIFI_DOWN,
+        MQTT_DOWN,
+        CONNECTED,
+    };
+
+    // Args:
+    //   hooks: Network operations, see the top of this file.
+    //   wifiRetryMs: Wait before restarting Wi-Fi association, doubling up to wifiMaxMs.
+    //   mqttRetryMs: Wait before retrying the broker, doubling up to mqttMaxMs.
+    EcoSmartConnection(const EcoSmartConnectionHooks &hooks, uint32_t wifiRetryMs, uint32_t wifiMaxMs,
+                       uint32_t mqttRetryMs, uint32_t mqttMaxMs)
+            : _hooks(hooks), _wifi(wifiRetryMs, wifiMaxMs), _mqtt(mqttRetryMs, mqttMaxMs) {}
+
+    void seed(uint32_t seed) {
+        _wifi.seed(seed);
+        _mqtt.seed(seed ^ 0x9E3779B9U);
+    }
+
+    // Advance the connection by at most one attempt. Returns the new state.
+    State step(uint32_t nowMs) {
+        if (!_hooks.wifiUp()) {
+            _state = WIFI_DOWN;
+            if (_wifi.ready(nowMs)) {
+                // WiFi.begin() returns straight away; if we are still not
+                // associated when the wait is over, start again
+                _hooks.wifiBegin();
+                _wifi.failed(nowMs);
+            }
+            return _state;
+        }
+        _wifi.succeeded();
+
+        if (_hooks.mqttUp()) {
+            if (_state != CONNECTED) {
+                linkUp();
+            }
+            return _state;
+        }
+
+        _state = MQTT_DOWN;
+        if (_mqtt.ready(nowMs)) {
+            if (_hooks.mqttConnect()) {
+                linkUp();
+            } else {
+                _mqtt.failed(nowMs);
+            }
+        }
+        return _state;
+    }
+
+    State state() const {
+        return _state;
+    }
+
+    bool connected() const {
+        return _state == CONNECTED;
+    }
+
+    const EcoSmartBackoff &mqttBackoff() const {
+        return _mqtt;
+    }
+
+    // Number of times the link came (back) up.
+    uint32_t connects() const {
+        return _connects;
+    }
+
+private:
+    void linkUp() {
+        _state = CONNECTED;
+        _mqtt.succeeded();
+        _connects++;
+        _hooks.onConnected();
+    }
+
+    EcoSmartConnectionHooks _hooks;
+    EcoSmartBackoff _wifi;
+    EcoSmartBackoff _mqtt;
+    State _state = WIFI_DOWN;
+    uint32_t _connects = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_CONNECTION_H
@@ -0,0 +1,158 @@
+//
+// Raw capture corpus: a recorder that streams every mark and space off the
+// receive pin, and the file format it writes.
+//
+// A corpus file is an 8 byte header followed by durations:
+//
+//   "ECSR"  magic
+//   uint8   format version (ECOSMART_CORPUS_VERSION)
+//   uint8   flags, 0
+//   uint16  reserved, 0
+//   varint  durations in us (LEB128), alternating levels, exactly as the
+//           receiver measured them, gaps included
+//
+// A duration of 0 marks a discontinuity (edges were lost), after which the
+// next duration starts a new burst. tools/ecosmart_replay.cpp runs a corpus
+// through the decoder on the host.
+//
+// Usage:
+//   receiver.setTap(EcoSmartCorpusRecorder::tap, &recorder);
+//   recorder.start();
+//   recorder.drain(writeToClient, &client);      // from loop()
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_CORPUS_H
+#define ECOSMART_NODEMCU_ECOSMART_CORPUS_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "ecosmart_compat.h"
+#include "ecosmart_queue.h"
+
+
+#define ECOSMART_CORPUS_MAGIC       "ECSR"
+#define ECOSMART_CORPUS_VERSION     1U
+#define ECOSMART_CORPUS_HEADER      8U      // bytes
+#define ECOSMART_CORPUS_QUEUE     128U      // durations waiting for loop(), power of two
+#define ECOSMART_CORPUS_BATCH      32U      // durations written per write() call
+
+
+// Write len bytes somewhere. Returns the number of bytes written.
+typedef size_t (*EcoSmartCorpusWrite)(const uint8_t *data, size_t len, void *arg);
+
+
+inline void ecoSmartCorpusHeader(uint8_t out[ECOSMART_CORPUS_HEADER]) {
+    memcpy(out, ECOSMART_CORPUS_MAGIC, 4);
+    out[4] = ECOSMART_CORPUS_VERSION;
+    out[5] = 0;
+    out[6] = 0;
+    out[7] = 0;
+}
+
+inline bool ecoSmartCorpusCheckHeader(const uint8_t *in, size_t len) {
+    return len >= ECOSMART_CORPUS_HEADER && memcmp(in, ECOSMART_CORPUS_MAGIC, 4) == 0 &&
+           in[4] == ECOSMART_CORPUS_VERSION;
+}
+
+// Append value as a LEB128 varint. Returns the number of bytes, at most 5.
+inline uint8_t ecoSmartVarint(uint32_t value, uint8_t *out) {
+    uint8_t n = 0;
+    for (; value > 0x7F; value >>= 7) {
+        out[n++] = static_cast<uint8_t>(value & 0x7F) | 0x80;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+// Read a varint at *pos. Returns false at the end of the data (or if it is
+// truncated there).
+inline bool ecoSmartReadVarint(const uint8_t *in, size_t len, size_t *pos, uint32_t *value) {
+    uint32_t result = 0;
+    for (uint8_t shift = 0; *pos < len && shift < 35; shift += 7) {
+        uint8_t b = in[(*pos)++];
+        result |= static_cast<uint32_t>(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+class EcoSmartCorpusRecorder {
+public:
+    // Receiver tap, see EcoSmartReceiver::setTap().
+    static void IRAM_ATTR tap(uint32_t us, void *arg) {
+        static_cast<EcoSmartCorpusRecorder *>(arg)->edge(us);
+    }
+
+    void IRAM_ATTR edge(uint32_t us) {
+        if (_recording) {
+            _edges.push(us);
+        }
+    }
+
+    // Start a new corpus; the header goes out with the next drain().
+    void start() {
+        uint32_t us;
+        while (_edges.pop(&us)) {
+        }
+        _lastOverflows = _edges.overflows();
+        _header = true;
+        _recording = true;
+    }
+
+    void stop() {
+        _recording = false;
+    }
+
+    bool recording() const {
+        return _recording;
+    }
+
+    // Write out what has been recorded since the last call. Returns false if
+    // write() did not take everything, e.g. because the client went away.
+    bool drain(EcoSmartCorpusWrite write, void *arg) {
+        uint8_t buffer[ECOSMART_CORPUS_HEADER + 5 * (ECOSMART_CORPUS_BATCH + 1)];
+        size_t len = 0;
+        if (_header) {
+            ecoSmartCorpusHeader(buffer);
+            len = ECOSMART_CORPUS_HEADER;
+            _header = false;
+        }
+        if (_edges.overflows() != _lastOverflows) {
+            _lastOverflows = _edges.overflows();
+            len += ecoSmartVarint(0, buffer + len);
+        }
+
+        uint32_t us;
+        for (uint8_t i = 0; i < ECOSMART_CORPUS_BATCH && _edges.pop(&us); i++) {
+            len += ecoSmartVarint(us != 0 ? us : 1, buffer + len);
+            _recorded++;
+        }
+        return len == 0 || write(buffer, len, arg) == len;
+    }
+
+    // Number of durations written.
+    uint32_t recorded() const {
+        return _recorded;
+    }
+
+    // Number of durations lost because drain() was not called often enough.
+    uint32_t overflows() const {
+        return _edges.overflows();
+    }
+
+private:
+    EcoSmartQueue<uint32_t, ECOSMART_CORPUS_QUEUE> _edges;
+    volatile bool _recording = false;
+    bool _header = false;
+    uint32_t _lastOverflows = 0;
+    uint32_t _recorded = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_CORPUS_H
@@ -0,0 +1,535 @@
+//
+// Streaming EcoSmart decoder.
+//
+// EcoSmartDecoder is a small state machine that is fed one mark or space
+// duration at a time (header -> bits -> repeat space) and reports a frame the
+// moment its last bit arrives. EcoSmartReceiver feeds it straight from the
+// GPIO edge interrupt and queues timestamped frames for loop(), so no capture
+// buffer or end-of-message timeout is needed.
+//
+// With voting enabled the decoder remembers the last few repeats of a burst
+// and reports their per-bit majority, so one corrupted repeat no longer costs
+// the whole burst.
+//
+// Every abandoned frame is counted by the step it failed at, so failures can
+// be told apart in production without any logging on the interrupt path.
+//
+// With calibration enabled the decoder tracks the widths it actually sees in
+// cleanly decoded frames, and centres its matching windows on them, so slow
+// drift (temperature, cable length) does not push durations out of tolerance.
+// The learned widths are kept within ECOSMART_CALIBRATION_RANGE of nominal.
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_DECODER_H
+#define ECOSMART_NODEMCU_ECOSMART_DECODER_H
+
+
+#include <stdint.h>
+#include "ecosmart_compat.h"
+#include "ecosmart_protocol.h"
+#include "ecosmart_queue.h"
+#include "ecosmart_capture.h"
+#include "ecosmart_line.h"
+
+
+#define ECOSMART_TOLERANCE          25U     // percent, same as IRremoteESP8266's default
+#define ECOSMART_MARK_EXCESS        50U     // us, marks tend to read long and spaces short
+#define ECOSMART_GAP_US          15000U     // silence that ends a burst of frames
+#define ECOSMART_QUEUE_SIZE         16U     // decoded frames waiting for loop(), power of two
+#define ECOSMART_VOTE_DEPTH          5U     // repeats remembered per burst for majority voting
+#define ECOSMART_MAX_ERASURES        4U     // unreadable bits tolerated per repeat when voting
+#define ECOSMART_CALIBRATION_RANGE  20U     // percent the learned widths may move away from nominal
+#define ECOSMART_CALIBRATION_SHIFT   3U     // each clean frame moves the learned widths 1/8 of the way
+
+
+// True if the measured duration is within tolerance of the desired one.
+inline bool IRAM_ATTR ecoSmartMatch(uint32_t measured, uint32_t desired) {
+    return measured <= 2 * desired &&
+           measured * 100U >= desired * (100U - ECOSMART_TOLERANCE) &&
+           measured * 100U <= desired * (100U + ECOSMART_TOLERANCE);
+}
+
+inline bool IRAM_ATTR ecoSmartMatchMark(uint32_t measured, uint32_t desired) {
+    return ecoSmartMatch(measured, desired + ECOSMART_MARK_EXCESS);
+}
+
+inline bool IRAM_ATTR ecoSmartMatchSpace(uint32_t measured, uint32_t desired) {
+    return ecoSmartMatch(measured, desired - ECOSMART_MARK_EXCESS);
+}
+
+
+// Where a frame was abandoned.
+enum EcoSmartDecodeFailure : uint8_t {
+    ECOSMART_FAIL_HDR_MARK,     // first mark after a gap was not a header
+    ECOSMART_FAIL_HDR_SPACE,
+    ECOSMART_FAIL_BIT_MARK,
+    ECOSMART_FAIL_BIT_SPACE,
+    ECOSMART_FAIL_REPEAT,       // repeat space, or the mark after it, out of shape
+    ECOSMART_FAIL_REASONS,
+};
+
+// Short name of a failure reason, for stats and logs.
+inline const char *ecoSmartFailureName(uint8_t reason) {
+    static const char *const names[ECOSMART_FAIL_REASONS] = {"hdr_mark", "hdr_space", "bit_mark", "bit_space",
+                                                             "repeat"};
+    return reason < ECOSMART_FAIL_REASONS ? names[reason] : "unknown";
+}
+
+
+class EcoSmartDecoder {
+public:
+    explicit EcoSmartDecoder(uint16_t nbits = ECOSMART_BITS) : _nbits(nbits) {
+        resetCalibration();
+    }
+
+    // Keep every repeat of a burst and report the per-bit majority instead of
+    // requiring each repeat to decode cleanly on its own.
+    void setVoting(bool voting) {
+        _voting = voting;
+        _depth = 0;
+    }
+
+    // Learn the widths of marks and spaces from cleanly decoded frames.
+    void setCalibration(bool calibrate) {
+        _calibrate = calibrate;
+    }
+
+    // Go back to the nominal widths.
+    void resetCalibration() {
+        for (uint8_t i = 0; i < TIMINGS; i++) {
+            _learned[i] = static_cast<uint32_t>(observed(i)) << 4;
+            expect(i, observed(i));
+        }
+        _calibrations = 0;
+    }
+
+    // Forget any partial frame (and any votes from the burst). The next
+    // duration must be a header mark.
+    void IRAM_ATTR reset() {
+        _state = HDR_MARK;
+        _depth = 0;
+    }
+
+    // Feed the duration of the mark or space that just ended. Marks and spaces
+    // must alternate; call reset() after a gap so the next duration is a mark.
+    //
+    // Returns:
+    //   boolean: True if this duration completed a frame, see value().
+    bool IRAM_ATTR feed(uint32_t us) {
+        _failure = ECOSMART_FAIL_REASONS;
+        switch (_state) {
+            case IDLE:
+            case HDR_MARK:
+            case RPT_MARK:
+                // Nothing else in the protocol is as long as the header mark,
+                // so hunting for it also resynchronises after noise.
+                if (within(us, HDR_MARK_US)) {
+                    if (_state == RPT_MARK && _calibrate) {
+                        learn(RPT_SPACE_US, _rptSpace);
+                    }
+                    _attempts++;
+                    _hdrMark = us;
+                    _state = HDR_SPACE;
+                    return false;
+                }
+                if (_state == IDLE) {
+                    return false;
+                }
+                return fail(_state == HDR_MARK ? ECOSMART_FAIL_HDR_MARK : ECOSMART_FAIL_REPEAT);
+
+            case RPT_SPACE:
+                if (!within(us, RPT_SPACE_US)) {
+                    return fail(ECOSMART_FAIL_REPEAT);
+                }
+                _rptSpace = us;
+                _state = RPT_MARK;
+                return false;
+
+            case HDR_SPACE:
+                if (!within(us, HDR_SPACE_US)) {
+                    return fail(ECOSMART_FAIL_HDR_SPACE);
+                }
+                _hdrSpace = us;
+                _sums[BIT_MARK_HIGH_US] = _sums[BIT_MARK_LOW_US] = _sums[BIT_SPACE_US] = 0;
+                _counts[BIT_MARK_HIGH_US] = _counts[BIT_MARK_LOW_US] = _counts[BIT_SPACE_US] = 0;
+                _data = 0;
+                _known = 0;
+                _erasures = 0;
+                _count = 0;
+                _state = BIT_MARK;
+                return false;
+
+            case BIT_MARK:
+                _data <<= 1;
+                _known <<= 1;
+                if (within(us, BIT_MARK_HIGH_US)) {
+                    _data |= 1U;
+                    _known |= 1U;
+                    _sums[BIT_MARK_HIGH_US] += us;
+                    _counts[BIT_MARK_HIGH_US]++;
+                } else if (within(us, BIT_MARK_LOW_US)) {
+                    _known |= 1U;
+                    _sums[BIT_MARK_LOW_US] += us;
+                    _counts[BIT_MARK_LOW_US]++;
+                } else if (!_voting || ++_erasures > ECOSMART_MAX_ERASURES) {
+                    return fail(ECOSMART_FAIL_BIT_MARK);
+                }
+                if (++_count < _nbits) {
+                    _state = BIT_SPACE;
+                    return false;
+                }
+                // The frame is complete; it is followed by a repeat space and
+                // the next header, or by a gap.
+                _state = RPT_SPACE;
+                if (_calibrate && _erasures == 0) {
+                    calibrate();
+                }
+                if (_voting && !vote()) {
+                    return false;
+                }
+                if (!_voting) {
+                    _value = _data;
+                    _confidence = 100;
+                }
+                _decoded++;
+                return true;
+
+            case BIT_SPACE:
+                if (!within(us, BIT_SPACE_US)) {
+                    return fail(ECOSMART_FAIL_BIT_SPACE);
+                }
+                _sums[BIT_SPACE_US] += us;
+                _counts[BIT_SPACE_US]++;
+                _state = BIT_MARK;
+                return false;
+        }
+        return false;
+    }
+
+    uint64_t value() const {
+        return _value;
+    }
+
+    uint16_t bits() const {
+        return _nbits;
+    }
+
+    // Percentage of the votes behind value() that agreed with it. A bit read
+    // from only one repeat counts as half agreed, so a first repeat reports
+    // 50 until another backs it up. Always 100 when voting is off.
+    uint8_t confidence() const {
+        return _confidence;
+    }
+
+    // Number of headers seen, i.e. frames the decoder started on.
+    uint32_t attempts() const {
+        return _attempts;
+    }
+
+    // Number of frames reported.
+    uint32_t decoded() const {
+        return _decoded;
+    }
+
+    // Number of frames abandoned part way through since start-up.
+    uint32_t failures() const {
+        uint32_t total = 0;
+        for (uint8_t i = 0; i < ECOSMART_FAIL_REASONS; i++) {
+            total += _failures[i];
+        }
+        return total;
+    }
+
+    // Number of frames abandoned for the given reason.
+    uint32_t failures(EcoSmartDecodeFailure reason) const {
+        return _failures[reason];
+    }
+
+    // The widths the decoder currently expects, as measured on the receive
+    // pin (marks read long and spaces short by ECOSMART_MARK_EXCESS).
+    EcoSmartTiming timing() const {
+        return {_expect[HDR_MARK_US], _expect[HDR_SPACE_US], _expect[BIT_MARK_HIGH_US],
+                _expect[BIT_MARK_LOW_US], _expect[BIT_SPACE_US], _expect[RPT_SPACE_US]};
+    }
+
+    // The learned widths corrected for the receiver's bias, for transmitting
+    // frames that look like the heater's own.
+    EcoSmartTiming transmitTiming() const {
+        EcoSmartTiming timing = this->timing();
+        timing.hdrMark -= ECOSMART_MARK_EXCESS;
+        timing.hdrSpace += ECOSMART_MARK_EXCESS;
+        timing.bitMarkHigh -= ECOSMART_MARK_EXCESS;
+        timing.bitMarkLow -= ECOSMART_MARK_EXCESS;
+        timing.bitSpace += ECOSMART_MARK_EXCESS;
+        timing.rptSpace += ECOSMART_MARK_EXCESS;
+        return timing;
+    }
+
+    // Number of frames the widths were learned from.
+    uint32_t calibrations() const {
+        return _calibrations;
+    }
+
+    // Why the last feed() abandoned a frame, or ECOSMART_FAIL_REASONS if it
+    // did not.
+    EcoSmartDecodeFailure lastFailure() const {
+        return _failure;
+    }
+
+private:
+    // Index into the width tables, same order as EcoSmartTiming.
+    enum Width : uint8_t {
+        HDR_MARK_US,
+        HDR_SPACE_US,
+        BIT_MARK_HIGH_US,
+        BIT_MARK_LOW_US,
+        BIT_SPACE_US,
+        RPT_SPACE_US,
+        TIMINGS,
+    };
+
+    enum State : uint8_t {
+        IDLE,           // hunting for a header mark after an error
+        HDR_MARK,       // expecting a header mark after a gap
+        HDR_SPACE,
+        BIT_MARK,
+        BIT_SPACE,
+        RPT_SPACE,      // frame complete, expecting the repeat space
+        RPT_MARK,       // expecting the repeat's header mark
+    };
+
+    // Add the repeat just decoded to the burst's history and take the per-bit
+    // majority over it. Only reports a frame once every bit has a winner.
+    bool IRAM_ATTR vote() {
+        _history[_next] = _data;
+        _historyKnown[_next] = _known;
+        _next = (_next + 1) % ECOSMART_VOTE_DEPTH;
+        if (_depth < ECOSMART_VOTE_DEPTH) {
+            _depth++;
+        }
+
+        uint64_t value = 0;
+        uint16_t agree = 0;
+        uint16_t total = 0;
+        for (int16_t bit = _nbits - 1; bit >= 0; bit--) {
+            uint8_t ones = 0;
+            uint8_t zeros = 0;
+            for (uint8_t i = 0; i < _depth; i++) {
+                uint8_t slot = (_next + ECOSMART_VOTE_DEPTH - 1 - i) % ECOSMART_VOTE_DEPTH;
+                if ((_historyKnown[slot] >> bit) & 1U) {
+                    if ((_history[slot] >> bit) & 1U) {
+                        ones++;
+                    } else {
+                        zeros++;
+                    }
+                }
+            }
+            if (ones == zeros) {
+                return false;  // undecided (or unread) bit, wait for another repeat
+            }
+            value = (value << 1) | (ones > zeros ? 1U : 0U);
+            agree += ones > zeros ? ones : zeros;
+            total += ones + zeros < 2 ? 2 : ones + zeros;  // a lone read is only half a majority
+        }
+
+        _value = value;
+        _confidence = static_cast<uint8_t>(agree * 100U / total);
+        return true;
+    }
+
+    // Nominal width as it reads on the receive pin.
+    static uint16_t IRAM_ATTR observed(uint8_t width) {
+        switch (width) {
+            case HDR_MARK_US: return ECOSMART_HDR_MARK + ECOSMART_MARK_EXCESS;
+            case HDR_SPACE_US: return ECOSMART_HDR_SPACE - ECOSMART_MARK_EXCESS;
+            case BIT_MARK_HIGH_US: return ECOSMART_BIT_MARK_HIGH + ECOSMART_MARK_EXCESS;
+            case BIT_MARK_LOW_US: return ECOSMART_BIT_MARK_LOW + ECOSMART_MARK_EXCESS;
+            case BIT_SPACE_US: return ECOSMART_BIT_SPACE - ECOSMART_MARK_EXCESS;
+            default: return ECOSMART_RPT_SPACE - ECOSMART_MARK_EXCESS;
+        }
+    }
+
+    // Move a learned width towards a measurement, within the allowed range.
+    // Widths are kept in 1/16 us so small corrections are not rounded away.
+    void IRAM_ATTR learn(uint8_t width, uint32_t us) {
+        if (us == 0) {
+            return;
+        }
+        int32_t learned = static_cast<int32_t>(_learned[width]);
+        learned += (static_cast<int32_t>(us << 4) - learned) / (1 << ECOSMART_CALIBRATION_SHIFT);
+        int32_t nominal = static_cast<int32_t>(observed(width)) << 4;
+        int32_t range = nominal * static_cast<int32_t>(ECOSMART_CALIBRATION_RANGE) / 100;
+        if (learned < nominal - range) learned = nominal - range;
+        if (learned > nominal + range) learned = nominal + range;
+        _learned[width] = static_cast<uint32_t>(learned);
+        expect(width, static_cast<uint16_t>((learned + 8) >> 4));
+    }
+
+    // Set the width durations are matched against. The tolerance window is
+    // worked out here once, the same way ecoSmartMatch() applies it.
+    void IRAM_ATTR expect(uint8_t width, uint16_t us) {
+        _expect[width] = us;
+        _min[width] = static_cast<uint16_t>((us * (100U - ECOSMART_TOLERANCE) + 99U) / 100U);
+        _max[width] = static_cast<uint16_t>(us * (100U + ECOSMART_TOLERANCE) / 100U);
+    }
+
+    bool IRAM_ATTR within(uint32_t us, uint8_t width) const {
+        return us >= _min[width] && us <= _max[width];
+    }
+
+    // Learn from the frame that just decoded without erasures.
+    void IRAM_ATTR calibrate() {
+        learn(HDR_MARK_US, _hdrMark);
+        learn(HDR_SPACE_US, _hdrSpace);
+        for (uint8_t i = BIT_MARK_HIGH_US; i <= BIT_SPACE_US; i++) {
+            if (_counts[i] != 0) {
+                learn(i, _sums[i] / _counts[i]);
+            }
+        }
+        _calibrations++;
+    }
+
+    bool IRAM_ATTR fail(EcoSmartDecodeFailure reason) {
+        _failures[reason]++;
+        _failure = reason;
+        _state = IDLE;
+        return false;
+    }
+
+    uint16_t _nbits;
+    volatile State _state = IDLE;
+    uint16_t _count = 0;
+    uint64_t _data = 0;
+    uint64_t _known = 0;    // bits of _data that were actually read
+    uint8_t _erasures = 0;
+    uint64_t _value = 0;
+    uint8_t _confidence = 0;
+    volatile uint32_t _attempts = 0;
+    volatile uint32_t _decoded = 0;
+    volatile uint32_t _failures[ECOSMART_FAIL_REASONS] = {};
+    EcoSmartDecodeFailure _failure = ECOSMART_FAIL_REASONS;
+
+    bool _calibrate = false;
+    uint32_t _learned[TIMINGS];     // 1/16 us
+    uint16_t _expect[TIMINGS];      // us, what durations are matched against
+    uint16_t _min[TIMINGS];         // and the tolerance window around it
+    uint16_t _max[TIMINGS];
+    uint32_t _sums[TIMINGS] = {};   // per-frame totals, bit widths only
+    uint8_t _counts[TIMINGS] = {};
+    uint16_t _hdrMark = 0;
+    uint16_t _hdrSpace = 0;
+    uint16_t _rptSpace = 0;
+    volatile uint32_t _calibrations = 0;
+
+    bool _voting = false;
+    uint64_t _history[ECOSMART_VOTE_DEPTH] = {};
+    uint64_t _historyKnown[ECOSMART_VOTE_DEPTH] = {};
+    uint8_t _depth = 0;
+    uint8_t _next = 0;
+};
+
+
+// Called from the interrupt handler with every duration the receiver measures.
+typedef void (*EcoSmartEdgeTap)(uint32_t us, void *arg);
+
+
+// Feeds an EcoSmartDecoder from the edges on the receive pin and queues every
+// decoded frame for loop(), so bursts of repeats are not lost while loop() is
+// busy printing or publishing.
+class EcoSmartReceiver {
+public:
+#ifdef ARDUINO
+    // Each receiver gets its own pin interrupt, so several can run at once.
+    void begin(uint8_t pin) {
+        pinMode(pin, INPUT);
+        _lastEdge = micros();
+        attachInterruptArg(digitalPinToInterrupt(pin), &EcoSmartReceiver::isr, this, CHANGE);
+    }
+#endif
+
+    // Keep raw captures of failed decodes in recorder, nullptr to stop.
+    void setCapture(EcoSmartCaptureRecorder *recorder) {
+        _capture = recorder;
+    }
+
+    // Pass every measured duration, gaps included, to tap (e.g. a corpus
+    // recorder) as well. nullptr to stop.
+    void setTap(EcoSmartEdgeTap tap, void *arg = nullptr) {
+        _tapArg = arg;
+        _tap = tap;
+    }
+
+    // Handle a level change on the receive pin at the given time (in us).
+    void IRAM_ATTR edge(uint32_t now) {
+        uint32_t us = now - _lastEdge;
+        _lastEdge = now;
+        _line.edge(now, us);
+        EcoSmartEdgeTap tap = _tap;
+        if (tap != nullptr) {
+            tap(us, _tapArg);
+        }
+        if (us > ECOSMART_GAP_US) {
+            // end of the idle gap, the next duration is a mark
+            _decoder.reset();
+            if (_capture != nullptr) {
+                _capture->gap();
+            }
+            return;
+        }
+        if (_capture != nullptr) {
+            _capture->edge(us);
+        }
+        if (_decoder.feed(us)) {
+            EcoSmartFrameRecord record = {_decoder.value(), now, static_cast<uint8_t>(_decoder.bits()),
+                                          _decoder.confidence()};
+            _frames.push(record);
+        } else if (_capture != nullptr && _decoder.lastFailure() != ECOSMART_FAIL_REASONS) {
+            _capture->failed(_decoder.lastFailure(), now);
+        }
+    }
+
+    bool available() const {
+        return !_frames.empty();
+    }
+
+    // Take the oldest decoded frame. Returns false if there is none.
+    bool read(EcoSmartFrameRecord *record) {
+        return _frames.pop(record);
+    }
+
+    // Number of frames dropped because loop() did not drain the queue in time.
+    uint32_t overflows() const {
+        return _frames.overflows();
+    }
+
+    EcoSmartDecoder &decoder() {
+        return _decoder;
+    }
+
+    const EcoSmartDecoder &decoder() const {
+        return _decoder;
+    }
+
+    // When the heater is talking, see EcoSmartLineMonitor.
+    const EcoSmartLineMonitor &line() const {
+        return _line;
+    }
+
+private:
+#ifdef ARDUINO
+    static void IRAM_ATTR isr(void *arg) {
+        static_cast<EcoSmartReceiver *>(arg)->edge(micros());
+    }
+#endif
+
+    EcoSmartDecoder _decoder;
+    EcoSmartLineMonitor _line;
+    uint32_t _lastEdge = 0;
+    EcoSmartQueue<EcoSmartFrameRecord, ECOSMART_QUEUE_SIZE> _frames;
+    EcoSmartCaptureRecorder *volatile _capture = nullptr;
+    volatile EcoSmartEdgeTap _tap = nullptr;
+    void *_tapArg = nullptr;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_DECODER_H
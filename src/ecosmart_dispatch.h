@@ -0,0 +1,146 @@
+//
+// Allocation-free inbound MQTT dispatch.
+//
+// Subscribed topics are registered once with a small handler id, so an
+// incoming message is routed by one hash over its topic instead of a strcmp
+// chain. Payloads are parsed in place from PubSubClient's buffer with bounded
+// parsers; anything unknown or oversized is rejected without being copied.
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_DISPATCH_H
+#define ECOSMART_NODEMCU_ECOSMART_DISPATCH_H
+
+
+#include <stdint.h>
+#include <string.h>
+
+
+#define ECOSMART_MAX_PAYLOAD        16U     // longest command payload we accept
+#define ECOSMART_NO_HANDLER         (-1)
+
+
+// FNV-1a, cheap and good enough to tell a handful of topics apart.
+inline uint32_t ecoSmartTopicHash(const char *topic, size_t *len) {
+    uint32_t hash = 2166136261U;
+    const char *p = topic;
+    for (; *p != '\0'; p++) {
+        hash = (hash ^ static_cast<uint8_t>(*p)) * 16777619U;
+    }
+    *len = static_cast<size_t>(p - topic);
+    return hash;
+}
+
+
+template<uint8_t N>
+class EcoSmartDispatcher {
+public:
+    // Register a topic (which must outlive the dispatcher) under a handler id.
+    // Returns false if the table is full.
+    bool add(const char *topic, uint8_t id) {
+        if (_count >= N) {
+            return false;
+        }
+        Entry &entry = _entries[_count++];
+        entry.topic = topic;
+        entry.hash = ecoSmartTopicHash(topic, &entry.len);
+        entry.id = id;
+        return true;
+    }
+
+    // Handler id for topic, or ECOSMART_NO_HANDLER.
+    int16_t lookup(const char *topic) const {
+        size_t len;
+        uint32_t hash = ecoSmartTopicHash(topic, &len);
+        for (uint8_t i = 0; i < _count; i++) {
+            const Entry &entry = _entries[i];
+            if (entry.hash == hash && entry.len == len && memcmp(entry.topic, topic, len) == 0) {
+                return entry.id;
+            }
+        }
+        return ECOSMART_NO_HANDLER;
+    }
+
+private:
+    struct Entry {
+        const char *topic;
+        size_t len;
+        uint32_t hash;
+        uint8_t id;
+    };
+
+    Entry _entries[N];
+    uint8_t _count = 0;
+};
+
+
+// Parse a decimal number such as "41", "-3" or "105.55" straight from the
+// payload in tenths (410, -30, 1055). Further digits are dropped, not
+// rounded, so that rounding to a whole degree (ecoSmartRoundTenths()) only
+// happens once: "41.45" is 414 and so 41, as strtof() and roundf() give.
+//
+// Returns:
+//   boolean: False if the payload is empty, too long, not a number, or
+//            outside [min, max] (in tenths).
+inline bool ecoSmartParseTenths(const uint8_t *payload, unsigned int length, int32_t min, int32_t max,
+                                int32_t *value) {
+    if (length == 0 || length > ECOSMART_MAX_PAYLOAD) {
+        return false;
+    }
+
+    unsigned int i = 0;
+    bool negative = payload[0] == '-';
+    if (negative || payload[0] == '+') {
+        i++;
+    }
+
+    int32_t result = 0;
+    unsigned int digits = 0;
+    for (; i < length && payload[i] >= '0' && payload[i] <= '9'; i++, digits++) {
+        result = result * 10 + (payload[i] - '0');
+    }
+    if (digits == 0 || digits > 8) {
+        return false;
+    }
+    result *= 10;
+
+    if (i < length && payload[i] == '.') {
+        i++;
+        if (i < length && payload[i] >= '0' && payload[i] <= '9') {
+            result += payload[i++] - '0';
+        }
+        for (; i < length && payload[i] >= '0' && payload[i] <= '9'; i++) {
+        }
+    }
+    if (i != length) {
+        return false;
+    }
+
+    if (negative) {
+        result = -result;
+    }
+    if (result < min || result > max) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+// Match the payload against a fixed set of words.
+//
+// Returns:
+//   The index of the matching choice, or -1 if none matches.
+inline int8_t ecoSmartParseChoice(const uint8_t *payload, unsigned int length, const char *const *choices,
+                                  uint8_t count) {
+    if (length > ECOSMART_MAX_PAYLOAD) {
+        return -1;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (strlen(choices[i]) == length && memcmp(choices[i], payload, length) == 0) {
+            return static_cast<int8_t>(i);
+        }
+    }
+    return -1;
+}
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_DISPATCH_H
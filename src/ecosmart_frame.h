@@ -0,0 +1,193 @@
+//
+// Typed view of a 40-bit EcoSmart frame.
+//
+// Wraps the raw command value with constexpr accessors for the known fields
+// (see "Decoding the protocol" in the README), so the bit layout lives in one
+// place instead of in shift macros and hand-written masks. Everything is
+// inline and constexpr, so it compiles down to the same shifts and masks.
+//
+//   EcoSmartFrame frame(0x0F3C186929);   // on, C display, no flow, 105F / 41C
+//   frame.setTempF(110);
+//   frame.setTempC(43);
+//   transmitter.send(frame.raw(), ECOSMART_BITS, RPT_CODES);
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_FRAME_H
+#define ECOSMART_NODEMCU_ECOSMART_FRAME_H
+
+
+#include <stdint.h>
+#include "ecosmart_protocol.h"
+
+
+#define ECOSMART_FRAME_BYTES        (ECOSMART_BITS / 8)
+
+
+class EcoSmartFrame {
+public:
+    // Bit positions, counted from the LSB of the last byte on the wire.
+    static constexpr uint8_t ON_BIT = 19;       // byte 3, 0x08
+    static constexpr uint8_t C_BIT = 20;        // byte 3, 0x10
+    static constexpr uint8_t FLOW_BIT = 21;     // byte 3, 0x20
+    static constexpr uint8_t TEMP_F_SHIFT = 8;  // byte 4
+    static constexpr uint8_t TEMP_C_SHIFT = 0;  // byte 5
+
+    static constexpr uint64_t MASK = (1ULL << ECOSMART_BITS) - 1;
+
+    constexpr EcoSmartFrame() : _raw(0) {}
+
+    constexpr explicit EcoSmartFrame(uint64_t raw) : _raw(raw & MASK) {}
+
+    // Build a frame from its bytes in wire order (bytes[0] is sent first).
+    static constexpr EcoSmartFrame fromBytes(const uint8_t bytes[ECOSMART_FRAME_BYTES]) {
+        return EcoSmartFrame((uint64_t) bytes[0] << 32 | (uint64_t) bytes[1] << 24 |
+                             (uint64_t) bytes[2] << 16 | (uint64_t) bytes[3] << 8 | (uint64_t) bytes[4]);
+    }
+
+    constexpr uint64_t raw() const {
+        return _raw;
+    }
+
+    // Byte i in wire order, 0 being the first byte sent.
+    constexpr uint8_t byteAt(uint8_t i) const {
+        return static_cast<uint8_t>(_raw >> (8 * (ECOSMART_FRAME_BYTES - 1 - i)));
+    }
+
+    void toBytes(uint8_t bytes[ECOSMART_FRAME_BYTES]) const {
+        for (uint8_t i = 0; i < ECOSMART_FRAME_BYTES; i++) {
+            bytes[i] = byteAt(i);
+        }
+    }
+
+    constexpr bool on() const {
+        return bit(ON_BIT);
+    }
+
+    constexpr bool celsius() const {
+        return bit(C_BIT);
+    }
+
+    constexpr bool flow() const {
+        return bit(FLOW_BIT);
+    }
+
+    constexpr uint8_t tempF() const {
+        return field(TEMP_F_SHIFT);
+    }
+
+    constexpr uint8_t tempC() const {
+        return field(TEMP_C_SHIFT);
+    }
+
+    // Copies with one field replaced, usable in constant expressions.
+    constexpr EcoSmartFrame withOn(bool on) const {
+        return withBit(ON_BIT, on);
+    }
+
+    constexpr EcoSmartFrame withCelsius(bool celsius) const {
+        return withBit(C_BIT, celsius);
+    }
+
+    constexpr EcoSmartFrame withFlow(bool flow) const {
+        return withBit(FLOW_BIT, flow);
+    }
+
+    constexpr EcoSmartFrame withTempF(uint8_t temp_f) const {
+        return withField(TEMP_F_SHIFT, temp_f);
+    }
+
+    constexpr EcoSmartFrame withTempC(uint8_t temp_c) const {
+        return withField(TEMP_C_SHIFT, temp_c);
+    }
+
+    void setOn(bool on) {
+        *this = withOn(on);
+    }
+
+    void setCelsius(bool celsius) {
+        *this = withCelsius(celsius);
+    }
+
+    void setFlow(bool flow) {
+        *this = withFlow(flow);
+    }
+
+    void setTempF(uint8_t temp_f) {
+        *this = withTempF(temp_f);
+    }
+
+    void setTempC(uint8_t temp_c) {
+        *this = withTempC(temp_c);
+    }
+
+    constexpr bool operator==(const EcoSmartFrame &other) const {
+        return _raw == other._raw;
+    }
+
+    constexpr bool operator!=(const EcoSmartFrame &other) const {
+        return _raw != other._raw;
+    }
+
+private:
+    constexpr bool bit(uint8_t shift) const {
+        return ((_raw >> shift) & 1U) != 0;
+    }
+
+    constexpr uint8_t field(uint8_t shift) const {
+        return static_cast<uint8_t>(_raw >> shift);
+    }
+
+    constexpr EcoSmartFrame withBit(uint8_t shift, bool value) const {
+        return EcoSmartFrame((_raw & ~(1ULL << shift)) | (static_cast<uint64_t>(value) << shift));
+    }
+
+    constexpr EcoSmartFrame withField(uint8_t shift, uint8_t value) const {
+        return EcoSmartFrame((_raw & ~(0xFFULL << shift)) | (static_cast<uint64_t>(value) << shift));
+    }
+
+    uint64_t _raw;
+};
+
+
+// Layout checks against the README's example frame, 0F 3C 18 6A 29.
+static_assert(sizeof(EcoSmartFrame) == sizeof(uint64_t), "EcoSmartFrame must stay a plain 64-bit value");
+static_assert(EcoSmartFrame(0x0F3C186A29ULL).byteAt(0) == 0x0F, "byte 1 is sent first");
+static_assert(EcoSmartFrame(0x0F3C186A29ULL).tempF() == 106, "byte 4 is the temperature in F");
+static_assert(EcoSmartFrame(0x0F3C186A29ULL).tempC() == 41, "byte 5 is the temperature in C");
+static_assert(EcoSmartFrame(0x0F3C186A29ULL).on() && EcoSmartFrame(0x0F3C186A29ULL).celsius() &&
+              !EcoSmartFrame(0x0F3C186A29ULL).flow(), "byte 3 0x18 is on, C, no flow");
+static_assert(EcoSmartFrame(0x0F3C000000ULL).withOn(true).withCelsius(true).withFlow(true).byteAt(2) == 0x38,
+              "byte 3 0x38 is on, C, flow");
+static_assert(EcoSmartFrame(0x0F3C186A29ULL).withTempF(140).withTempC(60).raw() == 0x0F3C188C3CULL,
+              "temperature setters only touch their own byte");
+
+#if __cplusplus >= 201402L
+// Every value of every field survives a set/get round trip and leaves the
+// rest of the frame alone.
+constexpr bool ecoSmartFrameRoundTrips() {
+    const EcoSmartFrame base(0x0F3C186A29ULL);
+    for (uint16_t v = 0; v < 256; v++) {
+        EcoSmartFrame f = base.withTempF(v);
+        if (f.tempF() != v || f.withTempF(base.tempF()) != base) {
+            return false;
+        }
+        f = base.withTempC(v);
+        if (f.tempC() != v || f.withTempC(base.tempC()) != base) {
+            return false;
+        }
+    }
+    for (uint8_t b = 0; b < 2; b++) {
+        if (base.withOn(b).on() != b || base.withOn(b).withOn(base.on()) != base ||
+            base.withCelsius(b).celsius() != b || base.withCelsius(b).withCelsius(base.celsius()) != base ||
+            base.withFlow(b).flow() != b || base.withFlow(b).withFlow(base.flow()) != base) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(ecoSmartFrameRoundTrips(), "field setters and getters must round-trip bit-exactly");
+#endif
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_FRAME_H
@@ -0,0 +1,195 @@
+//
+// Compressed journal of decoded frames, kept while MQTT is unreachable.
+//
+// The heater repeats the same frame for minutes at a time, so only changes
+// are stored. Each record is delta-encoded against the previous one:
+//
+//   [mask] [time delta, LEB128 varint, ms] [changed bytes...]
+//
+// where bit i of mask says that byte i of the frame changed. A flow on/off
+// transition minutes after the previous change costs 5 bytes. When the buffer is full the oldest records are
+// folded into the base frame, so the journal always replays the newest
+// history it can hold.
+//
+// The journal holds no pointers, so it can be copied to and from flash as it
+// is (see JOURNAL_FLASH in ecosmart_remote.cpp).
+//
+// Usage:
+//   journal.append(frame, millis());              // while offline
+//   EcoSmartJournalEntry entry;
+//   if (journal.peek(&entry) && publish(entry)) { // after reconnecting
+//       journal.pop();
+//   }
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_JOURNAL_H
+#define ECOSMART_NODEMCU_ECOSMART_JOURNAL_H
+
+
+#include <stdint.h>
+#include "ecosmart_frame.h"
+
+
+#define ECOSMART_JOURNAL_MAX_RECORD (1 + 5 + ECOSMART_FRAME_BYTES)   // mask, varint, bytes
+
+
+struct EcoSmartJournalEntry {
+    uint64_t frame;
+    uint32_t millis;    // millis() when the frame was first seen
+};
+
+
+template<uint16_t N>
+class EcoSmartJournal {
+    static_assert(N >= 2 * ECOSMART_JOURNAL_MAX_RECORD, "journal too small to hold a record");
+
+public:
+    // Record frame if it differs from the last frame journaled.
+    // Returns false if it was a repeat and nothing was stored.
+    bool append(uint64_t frame, uint32_t nowMs) {
+        if (_hasLast && frame == _last) {
+            return false;
+        }
+        if (_used == 0) {
+            _base = _last;
+            _baseMillis = nowMs;
+            _lastMillis = nowMs;
+        }
+
+        uint8_t record[ECOSMART_JOURNAL_MAX_RECORD];
+        uint8_t len = 1;
+        uint8_t mask = 0;
+        for (uint32_t delta = nowMs - _lastMillis;; delta >>= 7) {
+            record[len++] = static_cast<uint8_t>(delta & 0x7F) | (delta > 0x7F ? 0x80 : 0);
+            if (delta <= 0x7F) {
+                break;
+            }
+        }
+        for (uint8_t i = 0; i < ECOSMART_FRAME_BYTES; i++) {
+            uint8_t value = byteOf(frame, i);
+            if (value != byteOf(_last, i)) {
+                mask |= 1U << i;
+                record[len++] = value;
+            }
+        }
+        record[0] = mask;
+
+        while (N - _used < len) {
+            evict();
+        }
+        for (uint8_t i = 0; i < len; i++) {
+            _buffer[(_start + _used + i) % N] = record[i];
+        }
+        _used += len;
+        _records++;
+        _last = frame;
+        _lastMillis = nowMs;
+        _hasLast = true;
+        return true;
+    }
+
+    // The oldest record, without removing it. Returns false if empty.
+    bool peek(EcoSmartJournalEntry *entry) const {
+        if (_used == 0) {
+            return false;
+        }
+        uint64_t frame = _base;
+        uint32_t millis = _baseMillis;
+        decode(&frame, &millis);
+        entry->frame = frame;
+        entry->millis = millis;
+        return true;
+    }
+
+    // Drop the oldest record, e.g. once peek() has been published.
+    void pop() {
+        if (_used != 0) {
+            uint16_t len = decode(&_base, &_baseMillis);
+            _start = (_start + len) % N;
+            _used -= len;
+            _records--;
+        }
+    }
+
+    // Shift every timestamp so the newest record is at nowMs, e.g. after
+    // restoring from flash, where the old millis() values mean nothing.
+    void rebase(uint32_t nowMs) {
+        uint32_t shift = nowMs - _lastMillis;
+        _baseMillis += shift;
+        _lastMillis += shift;
+    }
+
+    bool empty() const {
+        return _used == 0;
+    }
+
+    uint16_t records() const {
+        return _records;
+    }
+
+    // Bytes of the buffer in use.
+    uint16_t used() const {
+        return _used;
+    }
+
+    static constexpr uint16_t capacity() {
+        return N;
+    }
+
+    // Number of records discarded to make room for newer ones.
+    uint32_t dropped() const {
+        return _dropped;
+    }
+
+private:
+    static uint8_t byteOf(uint64_t frame, uint8_t i) {
+        return static_cast<uint8_t>(frame >> (8 * (ECOSMART_FRAME_BYTES - 1 - i)));
+    }
+
+    // Apply the oldest record to frame/millis. Returns its length in bytes.
+    uint16_t decode(uint64_t *frame, uint32_t *millis) const {
+        uint16_t pos = _start;
+        uint8_t mask = _buffer[pos];
+        pos = (pos + 1) % N;
+
+        uint32_t delta = 0;
+        for (uint8_t shift = 0;; shift += 7) {
+            uint8_t b = _buffer[pos];
+            pos = (pos + 1) % N;
+            delta |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if ((b & 0x80) == 0) {
+                break;
+            }
+        }
+        *millis += delta;
+
+        for (uint8_t i = 0; i < ECOSMART_FRAME_BYTES; i++) {
+            if (mask & (1U << i)) {
+                uint8_t offset = 8 * (ECOSMART_FRAME_BYTES - 1 - i);
+                *frame = (*frame & ~(0xFFULL << offset)) | static_cast<uint64_t>(_buffer[pos]) << offset;
+                pos = (pos + 1) % N;
+            }
+        }
+        return static_cast<uint16_t>((pos + N - _start) % N);
+    }
+
+    // Fold the oldest record into the base to free its bytes.
+    void evict() {
+        pop();
+        _dropped++;
+    }
+
+    uint8_t _buffer[N];
+    uint16_t _start = 0;            // offset of the oldest record
+    uint16_t _used = 0;
+    uint16_t _records = 0;
+    uint64_t _base = 0;             // frame before the oldest record
+    uint32_t _baseMillis = 0;
+    uint64_t _last = 0;             // newest frame journaled, records delta against it
+    uint32_t _lastMillis = 0;
+    bool _hasLast = false;
+    uint32_t _dropped = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_JOURNAL_H
@@ -0,0 +1,95 @@
+//
+// When is the heater quiet? Line activity as seen by the receiver.
+//
+// The heater's controller talks while we do: a command sent in the middle of
+// one of its bursts is garbled on the way in. EcoSmartLineMonitor follows
+// the receive line's edges to tell when the heater is mid-burst. Once the
+// heater's bursts have come at a steady period, it also tells when the next
+// burst is due, so that a transmission only starts if it will be over first.
+//
+// Usage:
+//   monitor.edge(now, us);                             // every edge, from the ISR
+//   uint32_t wait = monitor.waitUs(micros(), airtime);  // 0 when clear to send
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_LINE_H
+#define ECOSMART_NODEMCU_ECOSMART_LINE_H
+
+
+#include <stdint.h>
+#include "ecosmart_compat.h"
+
+
+#define ECOSMART_LINE_IDLE_US        15000U     // silence that ends a burst, as ECOSMART_GAP_US
+#define ECOSMART_LINE_GUARD_US        5000U     // kept clear before the heater's next expected burst
+#define ECOSMART_LINE_MIN_PERIOD_US 100000U     // bursts closer than this are not taken as periodic
+#define ECOSMART_LINE_STABLE          10U       // percent two intervals may differ and count as steady
+#define ECOSMART_LINE_STALE           4U        // periods without a burst before the period is forgotten
+
+
+class EcoSmartLineMonitor {
+public:
+    // An edge at now (us), us after the previous one.
+    void IRAM_ATTR edge(uint32_t now, uint32_t us) {
+        _lastEdge = now;
+        if (us <= ECOSMART_LINE_IDLE_US) {
+            return;
+        }
+
+        // a burst starts; its interval from the last one is the period if it
+        // matches the interval before
+        uint32_t interval = now - _burstStart;
+        uint32_t tolerance = _interval / 100 * ECOSMART_LINE_STABLE;
+        bool steady = _bursts > 1 && interval >= ECOSMART_LINE_MIN_PERIOD_US &&
+                      interval + tolerance >= _interval && interval <= _interval + tolerance;
+        _period = steady ? interval : 0;
+        _interval = interval;
+        _burstStart = now;
+        _bursts++;
+    }
+
+    // How long to hold back a transmission lasting airtimeUs that would
+    // start at now (us) so it neither talks over a burst in progress nor runs
+    // into the next expected one.
+    //
+    // Returns:
+    //   0 if it can start now, otherwise the time to wait in us.
+    uint32_t waitUs(uint32_t now, uint32_t airtimeUs) const {
+        uint32_t sinceEdge = now - _lastEdge;
+        if (_bursts != 0 && sinceEdge < ECOSMART_LINE_IDLE_US) {
+            return ECOSMART_LINE_IDLE_US - sinceEdge;
+        }
+        uint32_t period = _period;
+        uint32_t sinceBurst = now - _burstStart;
+        if (period == 0 || sinceBurst >= ECOSMART_LINE_STALE * period) {
+            return 0;
+        }
+        uint32_t phase = sinceBurst % period;
+        if (sinceBurst >= period && phase < ECOSMART_LINE_GUARD_US) {
+            // the next burst is overdue and may still be on its way
+            return ECOSMART_LINE_GUARD_US - phase;
+        }
+        uint32_t untilNext = period - phase;
+        return untilNext >= airtimeUs + ECOSMART_LINE_GUARD_US ? 0 : untilNext;
+    }
+
+    // The heater's burst period in us, 0 while it is not steady.
+    uint32_t periodUs() const {
+        return _period;
+    }
+
+    // Number of bursts seen.
+    uint32_t bursts() const {
+        return _bursts;
+    }
+
+private:
+    volatile uint32_t _lastEdge = 0;
+    volatile uint32_t _burstStart = 0;
+    volatile uint32_t _period = 0;
+    uint32_t _interval = 0;
+    volatile uint32_t _bursts = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_LINE_H
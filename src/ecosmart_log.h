@@ -0,0 +1,144 @@
+//
+// Non-blocking log sink.
+//
+// Messages are formatted into a fixed RAM ring and written out later, a bit
+// at a time, by drain() from loop(), so logging never waits for the UART.
+// When the ring is full a message is dropped and counted rather than waited
+// for. Levels are filtered at compile time: a message above
+// ECOSMART_LOG_LEVEL compiles to nothing, arguments included.
+//
+// Not for interrupt handlers; log from loop() context only.
+//
+// Usage:
+//   #define ECOSMART_LOG_LEVEL ECOSMART_LOG_DEBUG    // before including, optional
+//   ECOSMART_LOGI("command %s after %u ms", name, ms);
+//   ecoSmartLog().drain(writeSerial, nullptr);      // from loop()
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_LOG_H
+#define ECOSMART_NODEMCU_ECOSMART_LOG_H
+
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+#define ECOSMART_LOG_NONE            0
+#define ECOSMART_LOG_ERROR           1
+#define ECOSMART_LOG_WARN            2
+#define ECOSMART_LOG_INFO            3
+#define ECOSMART_LOG_DEBUG           4
+#define ECOSMART_LOG_VERBOSE         5
+
+#ifndef ECOSMART_LOG_LEVEL
+#define ECOSMART_LOG_LEVEL          ECOSMART_LOG_INFO
+#endif
+
+#ifndef ECOSMART_LOG_BYTES
+#define ECOSMART_LOG_BYTES        2048U     // ring size
+#endif
+#define ECOSMART_LOG_LINE          320U     // longest message, a raw capture line fits
+
+
+// Write len bytes somewhere without blocking. Returns the number of bytes
+// taken, which may be fewer.
+typedef size_t (*EcoSmartLogWrite)(const uint8_t *data, size_t len, void *arg);
+
+
+template<size_t N>
+class EcoSmartLogRing {
+public:
+    // Queue one line (a newline is appended). Returns false, and counts the
+    // line as dropped, if the ring has no room for it.
+    bool printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char line[ECOSMART_LOG_LINE];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(line, sizeof(line) - 1, format, args);
+        va_end(args);
+        if (len < 0) {
+            return false;
+        }
+        if (static_cast<size_t>(len) > sizeof(line) - 2) {
+            len = sizeof(line) - 2;
+            _truncated++;
+        }
+        line[len++] = '\n';
+        return write(line, static_cast<size_t>(len));
+    }
+
+    // Queue len bytes as they are.
+    bool write(const char *data, size_t len) {
+        if (len > N - _used) {
+            _dropped++;
+            return false;
+        }
+        for (size_t i = 0; i < len; i++) {
+            _ring[(_head + _used + i) % N] = static_cast<uint8_t>(data[i]);
+        }
+        _used += len;
+        return true;
+    }
+
+    // Hand queued bytes to write() until it takes fewer than offered or the
+    // ring is empty. Returns the number of bytes written.
+    size_t drain(EcoSmartLogWrite write, void *arg) {
+        size_t total = 0;
+        while (_used != 0) {
+            size_t chunk = _head + _used <= N ? _used : N - _head;
+            size_t n = write(_ring + _head, chunk, arg);
+            _head = (_head + n) % N;
+            _used -= n;
+            total += n;
+            if (n < chunk) {
+                break;
+            }
+        }
+        return total;
+    }
+
+    size_t used() const {
+        return _used;
+    }
+
+    // Lines dropped because the ring was full.
+    uint32_t dropped() const {
+        return _dropped;
+    }
+
+    // Lines cut to ECOSMART_LOG_LINE.
+    uint32_t truncated() const {
+        return _truncated;
+    }
+
+private:
+    uint8_t _ring[N];
+    size_t _head = 0;
+    size_t _used = 0;
+    uint32_t _dropped = 0;
+    uint32_t _truncated = 0;
+};
+
+
+typedef EcoSmartLogRing<ECOSMART_LOG_BYTES> EcoSmartLog;
+
+// The firmware's log.
+inline EcoSmartLog &ecoSmartLog() {
+    static EcoSmartLog log;
+    return log;
+}
+
+
+#define ECOSMART_LOG_AT(level, ...) \
+    do { if ((level) <= ECOSMART_LOG_LEVEL) ecoSmartLog().printf(__VA_ARGS__); } while (0)
+
+#define ECOSMART_LOGE(...)  ECOSMART_LOG_AT(ECOSMART_LOG_ERROR, __VA_ARGS__)
+#define ECOSMART_LOGW(...)  ECOSMART_LOG_AT(ECOSMART_LOG_WARN, __VA_ARGS__)
+#define ECOSMART_LOGI(...)  ECOSMART_LOG_AT(ECOSMART_LOG_INFO, __VA_ARGS__)
+#define ECOSMART_LOGD(...)  ECOSMART_LOG_AT(ECOSMART_LOG_DEBUG, __VA_ARGS__)
+#define ECOSMART_LOGV(...)  ECOSMART_LOG_AT(ECOSMART_LOG_VERBOSE, __VA_ARGS__)
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_LOG_H
@@ -0,0 +1,51 @@
+//
+// EcoSmart remote protocol constants, shared by the MQTT and ESPHome firmwares.
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_PROTOCOL_H
+#define ECOSMART_NODEMCU_ECOSMART_PROTOCOL_H
+
+
+#include <stdint.h>
+
+#define ECOSMART_HDR_MARK           7000U
+#define ECOSMART_HDR_SPACE          4000U
+#define ECOSMART_BIT_MARK_HIGH      2400U
+#define ECOSMART_BIT_MARK_LOW        720U
+#define ECOSMART_BIT_SPACE           840U
+#define ECOSMART_RPT_SPACE          2700U
+
+#define ECOSMART_BITS               40    // bits in a normal frame
+#define ECOSMART_MAX_BITS           64    // largest frame we will encode or decode
+
+// The frame's field layout lives in EcoSmartFrame (ecosmart_frame.h).
+
+
+// Mark and space widths in us. The decoder can learn these from the heater's
+// own frames (see EcoSmartDecoder::setCalibration()) and the encoder can
+// transmit with them.
+struct EcoSmartTiming {
+    uint16_t hdrMark;
+    uint16_t hdrSpace;
+    uint16_t bitMarkHigh;
+    uint16_t bitMarkLow;
+    uint16_t bitSpace;
+    uint16_t rptSpace;
+
+    static constexpr EcoSmartTiming nominal() {
+        return {ECOSMART_HDR_MARK, ECOSMART_HDR_SPACE, ECOSMART_BIT_MARK_HIGH, ECOSMART_BIT_MARK_LOW,
+                ECOSMART_BIT_SPACE, ECOSMART_RPT_SPACE};
+    }
+
+    bool operator==(const EcoSmartTiming &other) const {
+        return hdrMark == other.hdrMark && hdrSpace == other.hdrSpace && bitMarkHigh == other.bitMarkHigh &&
+               bitMarkLow == other.bitMarkLow && bitSpace == other.bitSpace && rptSpace == other.rptSpace;
+    }
+
+    bool operator!=(const EcoSmartTiming &other) const {
+        return !(*this == other);
+    }
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_PROTOCOL_H
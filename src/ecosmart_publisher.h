@@ -0,0 +1,133 @@
+//
+// Delta-only state publishing.
+//
+// The heater repeats its frame constantly, so publishing every field on every
+// frame floods the broker with identical messages. EcoSmartPublisher keeps the
+// last published value of each field and a dirty bit per field, and only
+// reports fields that changed, at most once per minimum interval (the latest
+// value wins). An optional periodic full refresh republishes everything.
+//
+// Usage:
+//   publisher.update(state);                    // on every frame / command
+//   uint8_t fields = publisher.due(millis());   // from loop()
+//   if (fields & ECOSMART_FIELD_MODE) { publish publisher.state().on ... }
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_PUBLISHER_H
+#define ECOSMART_NODEMCU_ECOSMART_PUBLISHER_H
+
+
+#include <stdint.h>
+
+
+#define ECOSMART_FIELD_MODE         0x01U
+#define ECOSMART_FIELD_FLOW         0x02U
+#define ECOSMART_FIELD_TEMPERATURE  0x04U
+#define ECOSMART_FIELD_ALL          0x07U
+
+
+// The values we publish, in the units we publish them in.
+struct EcoSmartState {
+    bool on;
+    bool flow;
+    uint8_t temperature;
+};
+
+
+class EcoSmartPublisher {
+public:
+    // Args:
+    //   minIntervalMs: Least time between two publishes of changed fields.
+    //   refreshIntervalMs: Republish every field this often, 0 to disable.
+    EcoSmartPublisher(uint32_t minIntervalMs, uint32_t refreshIntervalMs)
+            : _minInterval(minIntervalMs), _refreshInterval(refreshIntervalMs) {}
+
+    // Offer the current state. Fields equal to what is already published (or
+    // already pending) are suppressed.
+    void update(const EcoSmartState &state) {
+        uint8_t offered = ECOSMART_FIELD_ALL;
+        uint8_t changed = 0;
+        if (state.on != _sent.on) changed |= ECOSMART_FIELD_MODE;
+        if (state.flow != _sent.flow) changed |= ECOSMART_FIELD_FLOW;
+        if (state.temperature != _sent.temperature) changed |= ECOSMART_FIELD_TEMPERATURE;
+
+        // Every offered field either becomes (or stays) pending, or is
+        // suppressed; a pending field that is offered again replaces the
+        // earlier pending value, which is suppressed as well.
+        _suppressed += count(offered & ~changed) + count(changed & _dirty);
+        _dirty = changed | (_force ? ECOSMART_FIELD_ALL : 0);
+        _state = state;
+        _hasState = true;
+    }
+
+    // Publish every field on the next due() regardless of intervals, e.g. for
+    // a snapshot after (re)connecting.
+    void invalidate() {
+        _dirty = ECOSMART_FIELD_ALL;
+        _force = true;
+    }
+
+    // Fields that should be published now. They are considered published once
+    // returned, so call this only when the caller is able to publish. Nothing
+    // is due until a state has been offered.
+    uint8_t due(uint32_t nowMs) {
+        if (!_hasState) {
+            return 0;
+        }
+        bool refresh = _refreshInterval != 0 && nowMs - _lastRefresh >= _refreshInterval;
+        if (refresh || _force) {
+            _dirty = ECOSMART_FIELD_ALL;
+            _lastRefresh = nowMs;
+        } else if (_dirty == 0 || (_published != 0 && nowMs - _lastPublish < _minInterval)) {
+            return 0;
+        }
+
+        uint8_t fields = _dirty;
+        _dirty = 0;
+        _force = false;
+        _sent = _state;
+        _lastPublish = nowMs;
+        _published += count(fields);
+        return fields;
+    }
+
+    // The latest state offered, which is what due() fields should be
+    // published from.
+    const EcoSmartState &state() const {
+        return _state;
+    }
+
+    // Number of field publishes avoided because nothing had changed or a
+    // newer value replaced a pending one.
+    uint32_t suppressed() const {
+        return _suppressed;
+    }
+
+    uint32_t published() const {
+        return _published;
+    }
+
+private:
+    static uint8_t count(uint8_t fields) {
+        uint8_t n = 0;
+        for (; fields; fields &= fields - 1) {
+            n++;
+        }
+        return n;
+    }
+
+    uint32_t _minInterval;
+    uint32_t _refreshInterval;
+    EcoSmartState _state = {false, false, 0};   // latest offered
+    EcoSmartState _sent = {false, false, 0};    // last published
+    bool _hasState = false;
+    uint8_t _dirty = ECOSMART_FIELD_ALL;
+    bool _force = true;
+    uint32_t _lastPublish = 0;
+    uint32_t _lastRefresh = 0;
+    uint32_t _suppressed = 0;
+    uint32_t _published = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_PUBLISHER_H
@@ -0,0 +1,88 @@
+//
+// Fixed-capacity, lock-free single-producer/single-consumer queue.
+//
+// The producer (an interrupt handler) only ever writes _head and the
+// consumer (loop()) only ever writes _tail, so neither side needs to mask
+// interrupts. No heap is used; when the queue is full new items are dropped
+// and counted instead.
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_QUEUE_H
+#define ECOSMART_NODEMCU_ECOSMART_QUEUE_H
+
+
+#include <stdint.h>
+#include "ecosmart_compat.h"
+
+
+// Keep the compiler from moving slot accesses across index updates. The
+// ESP8266 is single core, so this is all the ordering we need.
+#define ECOSMART_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+
+// A decoded frame, stamped with micros() at the moment its last bit ended.
+struct EcoSmartFrameRecord {
+    uint64_t frame;
+    uint32_t micros;
+    uint8_t bits;
+    uint8_t confidence;  // percent of repeat votes agreeing, 100 without voting
+};
+
+
+template<typename T, uint16_t N>
+class EcoSmartQueue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "queue capacity must be a power of two");
+
+public:
+    // Producer side. Returns false (and counts an overflow) if the queue is full.
+    bool IRAM_ATTR push(const T &item) {
+        uint16_t head = _head;
+        if (static_cast<uint16_t>(head - _tail) >= N) {
+            _overflows++;
+            return false;
+        }
+        _items[head & (N - 1)] = item;
+        ECOSMART_BARRIER();
+        _head = head + 1;
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T *item) {
+        uint16_t tail = _tail;
+        if (tail == _head) {
+            return false;
+        }
+        ECOSMART_BARRIER();
+        *item = _items[tail & (N - 1)];
+        ECOSMART_BARRIER();
+        _tail = tail + 1;
+        return true;
+    }
+
+    bool empty() const {
+        return _tail == _head;
+    }
+
+    uint16_t size() const {
+        return static_cast<uint16_t>(_head - _tail);
+    }
+
+    static constexpr uint16_t capacity() {
+        return N;
+    }
+
+    // Number of items dropped because the consumer fell behind.
+    uint32_t overflows() const {
+        return _overflows;
+    }
+
+private:
+    T _items[N];
+    volatile uint16_t _head = 0;
+    volatile uint16_t _tail = 0;
+    volatile uint32_t _overflows = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_QUEUE_H
@@ -7,10 +7,10 @@
 #include <ESP8266mDNS.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
-#include <IRremoteESP8266.h>
-#include <IRrecv.h>
-#include <IRutils.h>
 #include <ecosmart_remote.h>
+#if JOURNAL_FLASH
+#include <EEPROM.h>
+#endif
 
 
 // WIFI and MQTT setup
@@ -34,9 +34,34 @@ const char *mode_state_topic = "ecosmart/mode";
 const char *temperature_command_topic = "ecosmart/temperature/set";
 const char *temperature_state_topic = "ecosmart/temperature";
 const char *flow_state_topic = "ecosmart/flow";
+const char *journal_topic = "ecosmart/journal";   // frames seen while offline, oldest first
+const char *stats_topic = "ecosmart/stats";
+const char *task_stats_topic = "ecosmart/stats/tasks";
+const char *usage_topic = "ecosmart/usage";
+const char *command_result_topic = "ecosmart/command/result";
+const char *analyzer_command_topic = "ecosmart/analyzer/set";   // "report" or "reset"
+const char *analyzer_topic = "ecosmart/analyzer";               // one message per frame byte
+
+enum Topic : uint8_t {
+    TOPIC_MODE,
+    TOPIC_TEMPERATURE,
+    TOPIC_ANALYZER,
+};
+
+enum Mode : int8_t {
+    MODE_OFF,
+    MODE_HEAT,
+};
 
 const char *on_mode = "heat";
 const char *off_mode = "off";
+const char *const modes[] = {off_mode, on_mode};  // indexed by MODE_OFF / MODE_HEAT
+enum AnalyzerCommand : int8_t {
+    ANALYZER_REPORT,
+    ANALYZER_RESET,
+};
+
+const char *const analyzer_commands[] = {"report", "reset"};  // indexed by AnalyzerCommand
 const char *flow_on = "ON";
 const char *flow_off = "OFF";
 
@@ -45,185 +70,458 @@ const char *flow_off = "OFF";
 bool use_c = true;
 
 
-// IR library
-#define MIN_UNKNOWN_SIZE       12
-#define CAPTURE_BUFFER_SIZE  8192
-#define TIMEOUT               15U  // Suits most messages, while not swallowing many repeats.
+#define INITIAL_COMMAND       0x0F3C186929 // When this device restarts, it should have an initial state (105/41)
 
 
-#define INITIAL_COMMAND       0x0F3C186929 // When this device restarts, it should have an initial state (105/41)
+// State publishing: changed fields are published at most this often...
+#define STATE_MIN_INTERVAL_MS        1000
+// ...and everything is republished this often (0 to only publish changes)
+#define STATE_REFRESH_INTERVAL_MS  300000
+
+
+// Commands are sent once no newer command has arrived for this long (turning
+// the heater off is always sent straight away)
+#define COMMAND_SETTLE_MS             300
+// A sent command counts as delivered once the heater's own frames report it;
+// without that it is sent again after this long, up to CONFIRM_RETRIES times
+// with the wait doubling each time (0 to trust every transmission)
+#define CONFIRM_TIMEOUT_MS           2000
+#define CONFIRM_RETRIES                 3
+// A due command waits for the heater to finish talking (and for room before
+// its next burst), but for no longer than this
+#define TX_MAX_DEFER_MS              1000
+
+
+// Reconnect backoff: the first retry comes after roughly the base wait, then
+// the wait doubles (with jitter) up to the maximum
+#define WIFI_RETRY_MS               10000
+#define WIFI_RETRY_MAX_MS           60000
+#define MQTT_RETRY_MS                2000
+#define MQTT_RETRY_MAX_MS          120000
+// Keep a single MQTT connection attempt from stalling the loop for long: the
+// TCP connect is bounded by the WiFiClient timeout, the MQTT handshake and
+// reads after it by PubSubClient's socket timeout. Both are set from this.
+#define MQTT_SOCKET_TIMEOUT_S           2
+
+
+// Frame changes seen while MQTT is down are journaled in this many bytes of
+// RAM (about 5 bytes per change) and replayed one every interval on reconnect
+#define JOURNAL_BYTES                2048
+#define JOURNAL_REPLAY_INTERVAL_MS    250
+
+
+// Decoder counters and timing histograms are published this often
+#define STATS_INTERVAL_MS           60000
+// The stats message can outgrow PubSubClient's default 256 byte packet buffer
+#define MQTT_BUFFER_SIZE              768
+
+
+// loop() runs each subsystem as a task, see setupTasks(); once a pass has
+// taken this long, logging and publishing wait for a later one
+#define LOOP_SLICE_US               10000
+#define MAX_TASKS                      10
+
+
+// Hot-water draws are summarised over this interval
+#define USAGE_INTERVAL_MS         3600000
+
+
+// Failed decodes are logged as raw captures for tools/ecosmart_capture.cpp:
+// one failure in CAPTURE_SAMPLE_EVERY, at most CAPTURE_PER_MINUTE a minute
+// (0 to turn capturing off)
+#define CAPTURE_SAMPLE_EVERY            1
+#define CAPTURE_PER_MINUTE              6
+
+
+// Connect to this TCP port ("nc <remote-ip> 2323 > capture.ecsr") to record
+// every mark and space received, for tools/ecosmart_replay.cpp (0 to disable)
+#define CORPUS_PORT                  2323
+
+
+// The decoder learns the widths of the heater's marks and spaces; set this to
+// also transmit with them once enough frames have been seen
+#define TX_LEARNED_TIMING           false
+#define TX_LEARNED_TIMING_FRAMES       64
+
+
+// Keep per-bit statistics over every decoded frame (about 1.5 kB of RAM) to
+// help work out the unknown bits; publish "report" to analyzer_command_topic
+#define ANALYZE_FRAMES               true
+
+
+// Take binary commands and state queries on this UDP port, for controllers on
+// the LAN that need a reply within milliseconds (see src/ecosmart_udp.h and
+// tools/ecosmart_udp.cpp). There is no authentication: anything that can reach
+// the port can command the heater. 0 to disable
+#define UDP_PORT                        0
 
 
 // instantiate objects and variables
 WiFiClient espClient;
 PubSubClient client(espClient);
 //EcoSmart ecoSmart;
-IRrecv irrecv(RECV_PIN, CAPTURE_BUFFER_SIZE, TIMEOUT, true);
-decode_results results;
+// One heater: the MQTT topics are per device. The ESPHome component can drive
+// several.
+EcoSmartChannel heater(RECV_PIN, OUTPUT_PIN, COMMAND_SETTLE_MS, RPT_CODES);
+EcoSmartScheduler scheduler;
+EcoSmartReceiver &receiver = heater.receiver();
+EcoSmartCommander &commander = heater.commander();
+EcoSmartTransmitter &transmitter = scheduler.transmitter();
+EcoSmartFrame &cmd = heater.command();
+EcoSmartPublisher publisher(STATE_MIN_INTERVAL_MS, STATE_REFRESH_INTERVAL_MS);
+EcoSmartDispatcher<3> topics;
+EcoSmartJournal<JOURNAL_BYTES> journal;
+EcoSmartHistogram loopStats;    // whole loop() iterations
+EcoSmartTasks<MAX_TASKS> tasks(LOOP_SLICE_US);
+EcoSmartHistogram txStats;      // starting a transmission
+EcoSmartHistogram deferStats;   // ms a due command waited for the heater to fall quiet
+EcoSmartUsage usage(USAGE_INTERVAL_MS);
+EcoSmartCaptureRecorder captures(CAPTURE_SAMPLE_EVERY, CAPTURE_PER_MINUTE);
+EcoSmartCorpusRecorder corpus;
+WiFiServer corpusServer(CORPUS_PORT);
+WiFiClient corpusClient;
+WiFiUDP udp;
+EcoSmartBitAnalyzer analyzer;
+uint8_t analyzerByte = ECOSMART_FRAME_BYTES;    // next byte to report, ECOSMART_FRAME_BYTES when done
+
+bool wifiUp();
+void wifiBegin();
+bool mqttUp();
+bool mqttConnect();
+void onConnected();
+void setupTasks();
+#if JOURNAL_FLASH
+void loadJournal();
+void saveJournal();
+#endif
+EcoSmartConnection connection({wifiUp, wifiBegin, mqttUp, mqttConnect, onConnected},
+                              WIFI_RETRY_MS, WIFI_RETRY_MAX_MS, MQTT_RETRY_MS, MQTT_RETRY_MAX_MS);
 
 bool stateOn = false;
 bool stateFlow = false;
 
-int codeType = -1; // The type of code
-unsigned long codeValue; // The code value if not raw
-unsigned int rawCodes[RAWBUF]; // The durations if raw
-int codeLen; // The length of the code
+uint32_t lastFailures = 0;
+uint32_t lastOverflows = 0;
+bool otaStarted = false;
+bool udpStarted = false;
+uint32_t lastReplay = 0;
+uint32_t lastStats = 0;
+uint32_t lastTiming = 0;
 
+#if JOURNAL_FLASH
+#define JOURNAL_MAGIC 0xEC05A401UL
+bool journalDirty = false;
+uint32_t lastJournalSave = 0;
+#endif
 
-uint64_t cmd;
 
+bool wifiUp() {
+    return WiFi.status() == WL_CONNECTED;
+}
 
-void setup_wifi() {
 
-    delay(10);
-    // We start by connecting to a WiFi network
-    Serial.println();
-    Serial.print("Connecting to ");
-    Serial.println(ssid);
+void wifiBegin() {
+    ECOSMART_LOGI("Connecting to %s", ssid);
 
-    WiFi.disconnect();
     WiFi.mode(WIFI_STA);
     WiFi.begin(ssid, password);
+}
 
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(500);
-        Serial.print(".");
-    }
 
-    Serial.println("");
-    Serial.println("WiFi connected");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
+bool mqttUp() {
+    return client.connected();
 }
 
 
-float ftoc(float temp_f) {
-    auto temp = (temp_f - 32) / 1.8;
-    return static_cast<float>(temp);
+bool mqttConnect() {
+    if (client.connect(SENSORNAME, mqtt_username, mqtt_password)) {
+        ECOSMART_LOGI("MQTT connected");
+        return true;
+    }
+    ECOSMART_LOGW("MQTT connection failed, rc=%d", client.state());
+    return false;
 }
 
 
-float ctof(float temp_c) {
-    auto temp = (temp_c * 1.8) + 32;
-    return static_cast<float>(temp);
-}
+void updateState(const EcoSmartFrame &frame) {
 
+    stateOn = frame.on();
+    use_c = frame.celsius();
+    stateFlow = frame.flow();
 
-byte getTempF() {
-    auto temp_f = static_cast<byte>((cmd >> ECOSMART_TEMP_F_SHIFT) & 0xFF);
-    return temp_f;
 }
 
+// Publish whichever state fields changed since they were last published,
+// once the minimum interval allows it.
+void publishState() {
+    // Leave fields dirty until there is a broker to publish them to
+    if (!connection.connected()) {
+        return;
+    }
+    uint8_t fields = publisher.due(millis());
+    if (fields == 0) {
+        return;
+    }
 
-byte getTempC() {
-    auto temp_c = static_cast<byte>((cmd >> ECOSMART_TEMP_C_SHIFT) & 0xFF);
-    return temp_c;
-}
+    const EcoSmartState &state = publisher.state();
+    ECOSMART_LOGD("sending state update via MQTT (fields 0x%x, %u suppressed so far)", fields,
+                  publisher.suppressed());
 
-void setTempF(byte temp_f) {
-    cmd &= ~(0xFF << ECOSMART_TEMP_F_SHIFT);
-    cmd |= temp_f << ECOSMART_TEMP_F_SHIFT;
+    if (fields & ECOSMART_FIELD_MODE) {
+        client.publish(mode_state_topic, (state.on) ? on_mode : off_mode);
+    }
+    if (fields & ECOSMART_FIELD_FLOW) {
+        client.publish(flow_state_topic, (state.flow) ? flow_on : flow_off);
+    }
+    if (fields & ECOSMART_FIELD_TEMPERATURE) {
+        char t[12];
+        sprintf(t, "%u", state.temperature);
+        client.publish(temperature_state_topic, t);
+    }
 }
 
-void setTempC(byte temp_c) {
-    cmd &= ~(0xFF << ECOSMART_TEMP_C_SHIFT);
-    cmd |= temp_c << ECOSMART_TEMP_C_SHIFT;
+void sendState(const EcoSmartFrame &frame) {
+    updateState(frame);
 
+    EcoSmartState state = {stateOn, stateFlow, use_c ? frame.tempC() : frame.tempF()};
+    publisher.update(state);
+    publishState();
 }
 
-void updateState() {
-
-    stateOn = ((cmd >> ECOSMART_ON_BIT_SHIFT) & 1U) == 1;
-    use_c = ((cmd >> ECOSMART_C_BIT_SHIFT) & 1U) == 1;
-    stateFlow = ((cmd >> ECOSMART_FLOW_BIT_SHIFT) & 1U) == 1;
 
+// Queue cmd for transmission. Commands arriving within COMMAND_SETTLE_MS of
+// each other are merged and only the latest is sent, see transmitCommand().
+void sendCommand() {
+    heater.request(millis());
 }
 
-void sendState() {
-    updateState();
 
-    Serial.println("sending state update via MQTT");
+void transmitCommand() {
+    uint32_t start = micros();
+    if (scheduler.loop(millis()) == nullptr) {
+        return;
+    }
+    txStats.add(micros() - start);
+    deferStats.add(scheduler.deferredMs());
+    uint64_t target = commander.target().raw();
+    ECOSMART_LOGI("writing command: %02X%08X (deferred %u ms, %u frames sent for %u commands)",
+                  static_cast<uint32_t>(target >> 32), static_cast<uint32_t>(target), scheduler.deferredMs(),
+                  commander.framesSent(), commander.received());
+}
 
-    int temp = lroundf(use_c ? getTempC() : getTempF());
-    char t[12];
-    sprintf(t, "%i", temp);
 
-    client.publish(mode_state_topic, (stateOn) ? on_mode : off_mode);
-    client.publish(flow_state_topic, (stateFlow) ? flow_on : flow_off);
-    client.publish(temperature_state_topic, t);
+void onTransmitDone(uint64_t data, void *arg) {
+    ECOSMART_LOGD("command sent: %02X%08X (%u us on the wire)", static_cast<uint32_t>(data >> 32),
+                  static_cast<uint32_t>(data), transmitter.airtimeUs());
 }
 
 
-void sendCommand() {
-    Serial.print("writing command: ");
-    serialPrintUint64(cmd, HEX);
-    Serial.println();
-    sendEcoSmart(cmd, 40, RPT_CODES);
-}
+// snprintf at out + len, without running past size, as
+// EcoSmartBitAnalyzer does. Returns what snprintf would have written, so the
+// running total ends up size or more if anything did not fit.
+size_t append(char *out, size_t size, size_t len, const char *format, ...) __attribute__((format(printf, 4, 5)));
 
+size_t append(char *out, size_t size, size_t len, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(len < size ? out + len : nullptr, len < size ? size - len : 0, format, args);
+    va_end(args);
+    return n < 0 ? 0 : static_cast<size_t>(n);
+}
 
-void callback(char *topic, byte *payload, int length) {
-    Serial.print("message received: [");
-    Serial.print(topic);
-    Serial.print("] ");
+// Publish the decoder counters (totals since start-up) and the timing
+// histograms (for the last interval, as [mean, p99, max] in us). A message
+// that did not fit is logged and not published, rather than sent cut short.
+void publishStats() {
+    if (!connection.connected() || millis() - lastStats < STATS_INTERVAL_MS) {
+        return;
+    }
+    lastStats = millis();
+
+    const EcoSmartDecoder &decoder = receiver.decoder();
+    char message[MQTT_BUFFER_SIZE - 64];
+    size_t len = append(message, sizeof(message), 0, "{\"attempts\":%u,\"decoded\":%u,\"failures\":{",
+                        decoder.attempts(), decoder.decoded());
+    for (uint8_t i = 0; i < ECOSMART_FAIL_REASONS; i++) {
+        len += append(message, sizeof(message), len, "%s\"%s\":%u", i ? "," : "",
+                      ecoSmartFailureName(i), decoder.failures(static_cast<EcoSmartDecodeFailure>(i)));
+    }
+    EcoSmartTiming timing = decoder.timing();
+    len += append(message, sizeof(message), len,
+                  "},\"overflows\":%u,\"tx_us\":[%u,%u,%u],\"airtime_us\":%u,\"loop_us\":[%u,%u,%u],"
+                  "\"timing_us\":[%u,%u,%u,%u,%u,%u],\"calibrations\":%u,\"commands\":[%u,%u,%u],"
+                  "\"defer_ms\":[%u,%u,%u],\"forced\":%u,\"log_dropped\":%u}",
+                  receiver.overflows(), txStats.mean(), txStats.percentile(99), txStats.max(),
+                  transmitter.airtimeUs(), loopStats.mean(), loopStats.percentile(99), loopStats.max(),
+                  timing.hdrMark, timing.hdrSpace, timing.bitMarkHigh, timing.bitMarkLow, timing.bitSpace,
+                  timing.rptSpace, decoder.calibrations(), commander.outcomes(ECOSMART_ACKNOWLEDGED),
+                  commander.outcomes(ECOSMART_RETRIED), commander.outcomes(ECOSMART_FAILED), deferStats.mean(),
+                  deferStats.percentile(99), deferStats.max(), scheduler.forced(), ecoSmartLog().dropped());
+    if (len < sizeof(message)) {
+        client.publish(stats_topic, message);
+    } else {
+        ECOSMART_LOGW("Stats need %u bytes, have %u", static_cast<unsigned>(len + 1),
+                      static_cast<unsigned>(sizeof(message)));
+    }
 
-    char message[length + 1];
-    for (int i = 0; i < length; i++) {
-        message[i] = (char) payload[i];
+    // per task: [runs, mean us, max us, over budget, deferred]
+    len = append(message, sizeof(message), 0, "{");
+    for (uint8_t i = 0; i < tasks.count(); i++) {
+        EcoSmartTaskStats task = tasks.stats(i);
+        len += append(message, sizeof(message), len, "%s\"%s\":[%u,%u,%u,%u,%u]", i ? "," : "",
+                      task.name, task.runs, task.meanUs, task.maxUs, task.overruns, task.deferrals);
+    }
+    len += append(message, sizeof(message), len, "}");
+    if (len < sizeof(message)) {
+        client.publish(task_stats_topic, message);
+    } else {
+        ECOSMART_LOGW("Task stats need %u bytes, have %u", static_cast<unsigned>(len + 1),
+                      static_cast<unsigned>(sizeof(message)));
     }
-    message[length] = '\0';
-    Serial.println(message);
 
+    loopStats.reset();
+    txStats.reset();
+    deferStats.reset();
+    tasks.resetStats();
+}
 
-    if (strcmp(topic, mode_command_topic) == 0) {
 
-        if (strcmp(message, on_mode) == 0) {
-            cmd |= 1ULL << ECOSMART_ON_BIT_SHIFT;
-            sendCommand();
-            stateOn = true;
+// Set both scales of the setpoint from a temperature in tenths of a degree,
+// in whichever scale the heater displays, clamped to its range.
+void setTemperature(int32_t tenths) {
+    EcoSmartSetpoint setpoint = use_c ? ecoSmartSetpointC(tenths) : ecoSmartSetpointF(tenths);
+    cmd.setTempF(setpoint.f);
+    cmd.setTempC(setpoint.c);
 
-        } else if (strcmp(message, off_mode) == 0) {
-            cmd &= ~(1ULL << ECOSMART_ON_BIT_SHIFT);
-            sendCommand();
-            stateOn = false;
-        }
+    sendCommand();
+}
 
-    } else if (strcmp(topic, temperature_command_topic) == 0) {
 
-        float temp_f = strtof(message, nullptr);
-        float temp_c = ftoc(temp_f);
+void setMode(bool on) {
+    cmd.setOn(on);
+    sendCommand();
+}
 
-        if (use_c) {
-            temp_c = strtof(message, nullptr);
-            temp_f = ctof(temp_c);
-        }
 
-        if (temp_f < 80) {
-            temp_f = 80;
-            temp_c = ftoc(temp_f);
-        } else if (temp_f > 140) {
-            temp_f = 140;
-            temp_c = ftoc(temp_f);
+// Called once an MQTT or UDP command has been taken on.
+void commandAccepted() {
+    // With confirmation the new state is published once the heater reports it
+    if (CONFIRM_TIMEOUT_MS == 0) {
+        sendState(cmd);
+    }
+}
+
+
+// Handle an inbound MQTT message. The payload is parsed in place; it is not
+// copied or NUL-terminated, and unknown topics or bad payloads are dropped.
+void callback(char *topic, byte *payload, unsigned int length) {
+    ECOSMART_LOGI("message received: [%s] %.*s", topic,
+                  static_cast<int>(length < ECOSMART_MAX_PAYLOAD ? length : ECOSMART_MAX_PAYLOAD), payload);
+
+    switch (topics.lookup(topic)) {
+        case TOPIC_MODE:
+            switch (ecoSmartParseChoice(payload, length, modes, 2)) {
+                case MODE_OFF:
+                    setMode(false);
+                    break;
+                case MODE_HEAT:
+                    setMode(true);
+                    break;
+                default:
+                    ECOSMART_LOGW("rejected: unknown mode");
+                    return;
+            }
+            break;
+
+        case TOPIC_TEMPERATURE: {
+            int32_t tenths;
+            if (!ecoSmartParseTenths(payload, length, ECOSMART_COMMAND_TENTHS_MIN, ECOSMART_COMMAND_TENTHS_MAX,
+                                     &tenths)) {
+                ECOSMART_LOGW("rejected: not a temperature");
+                return;
+            }
+            setTemperature(tenths);
+            break;
         }
 
+        case TOPIC_ANALYZER:
+            switch (ecoSmartParseChoice(payload, length, analyzer_commands, 2)) {
+                case ANALYZER_REPORT:
+                    analyzerByte = 0;
+                    return;
+                case ANALYZER_RESET:
+                    analyzer.reset();
+                    return;
+                default:
+                    ECOSMART_LOGW("rejected: unknown analyzer command");
+                    return;
+            }
 
-        setTempF(roundf(temp_f));
-        setTempC(roundf(temp_c));
+        default:
+            return;
+    }
+
+    commandAccepted();
+}
 
-        sendCommand();
 
+// Take on one UDP request through the same path as the MQTT commands.
+EcoSmartUdpStatus handleUdp(const EcoSmartUdpRequest &request) {
+    switch (request.type) {
+        case ECOSMART_UDP_SET_MODE:
+            if (request.value != MODE_OFF && request.value != MODE_HEAT) {
+                return ECOSMART_UDP_REJECTED;
+            }
+            setMode(request.value == MODE_HEAT);
+            break;
+        case ECOSMART_UDP_SET_TEMPERATURE:
+            // the same range as a temperature on MQTT
+            if (request.value < ECOSMART_COMMAND_TENTHS_MIN || request.value > ECOSMART_COMMAND_TENTHS_MAX) {
+                return ECOSMART_UDP_REJECTED;
+            }
+            setTemperature(request.value);
+            break;
+        case ECOSMART_UDP_QUERY:
+            return ECOSMART_UDP_ACCEPTED;
+        default:
+            return ECOSMART_UDP_UNKNOWN;
     }
+    commandAccepted();
+    return ECOSMART_UDP_ACCEPTED;
+}
 
-    sendState();
+
+// Answer pending UDP requests, a few per pass. Each reply carries the command
+// frame as it stands after the request.
+void serveUdp() {
+    for (uint8_t i = 0; i < ECOSMART_UDP_BATCH && udp.parsePacket() > 0; i++) {
+        uint8_t packet[ECOSMART_UDP_REQUEST_BYTES + 1];     // one spare byte to catch oversized packets
+        int len = udp.read(packet, sizeof(packet));
+        EcoSmartUdpRequest request;
+        if (len <= 0 || !ecoSmartUdpDecodeRequest(packet, static_cast<size_t>(len), &request)) {
+            continue;
+        }
+        EcoSmartUdpReply reply{request.type, request.sequence, handleUdp(request), cmd};
+        uint8_t out[ECOSMART_UDP_REPLY_BYTES];
+        ecoSmartUdpEncodeReply(reply, out);
+        udp.beginPacket(udp.remoteIP(), udp.remotePort());
+        udp.write(out, sizeof(out));
+        udp.endPacket();
+    }
 }
 
 
 void setup() {
     Serial.begin(115200);
 
-    setup_wifi();
     client.setServer(mqtt_server, mqtt_port);
+    espClient.setTimeout(MQTT_SOCKET_TIMEOUT_S * 1000UL);
+    client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+    client.setBufferSize(MQTT_BUFFER_SIZE);
     client.setCallback(callback);
+    topics.add(mode_command_topic, TOPIC_MODE);
+    topics.add(temperature_command_topic, TOPIC_TEMPERATURE);
+    topics.add(analyzer_command_topic, TOPIC_ANALYZER);
 
     //OTA SETUP
     ArduinoOTA.setPort(OTAport);
@@ -231,6 +529,8 @@ void setup() {
     ArduinoOTA.setHostname(SENSORNAME);
     ArduinoOTA.setPassword(OTA_PASSWORD);
 
+    // OTA reports go straight to Serial: loop(), and so the log, is stalled
+    // while an upload runs
     ArduinoOTA.onStart([]() {
         Serial.println("Starting");
     });
@@ -248,145 +548,362 @@ void setup() {
         else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive Failed");
         else if (error == OTA_END_ERROR) Serial.println("End Failed");
     });
-    ArduinoOTA.begin();
+    // ArduinoOTA.begin() needs the network; it is called from loop()
+
+    receiver.decoder().setVoting(true);  // Majority vote across repeats
+    receiver.decoder().setCalibration(true);  // Follow drift in the heater's timing
+    if (CAPTURE_PER_MINUTE > 0) {
+        receiver.setCapture(&captures);
+    }
+    if (CORPUS_PORT != 0) {
+        corpusServer.begin();
+    }
+    scheduler.add(&heater);  // Start the receiver and transmitter
+    commander.setConfirmation(CONFIRM_TIMEOUT_MS, CONFIRM_RETRIES);
+    scheduler.setMaxDefer(TX_MAX_DEFER_MS);
+
+    transmitter.onDone(onTransmitDone);
 
-#if DECODE_HASH
-    // Ignore messages with less than minimum on or off pulses.
-    irrecv.setUnknownThreshold(MIN_UNKNOWN_SIZE);
-#endif  // DECODE_HASH
-    irrecv.enableIRIn();  // Start the receiver
+#if JOURNAL_FLASH
+    loadJournal();
+#endif
 
-    pinMode(OUTPUT_PIN, OUTPUT);
+    setupTasks();
 
-    Serial.println("Ready");
-    Serial.print("IP Address: ");
-    Serial.println(WiFi.localIP());
+    // Wi-Fi and MQTT are brought up from loop(), without blocking
+    connection.seed(ESP.getChipId() ^ micros());
 
-    // set the initial state of the command
-    uint64_t init = INITIAL_COMMAND;
-    if (use_c) {
-        init |= 1ULL << ECOSMART_C_BIT_SHIFT;
+    ECOSMART_LOGI("Ready");
+
+    // take the initial command as the heater's state until it reports one
+    heater.observe(EcoSmartFrame(INITIAL_COMMAND).withCelsius(use_c), millis());
+}
+
+
+// Called each time the broker session (re)opens.
+void onConnected() {
+    ECOSMART_LOGI("IP address: %s", WiFi.localIP().toString().c_str());
+    client.subscribe(mode_command_topic);
+    client.subscribe(temperature_command_topic);
+    if (ANALYZE_FRAMES) {
+        client.subscribe(analyzer_command_topic);
+    }
+    // one consolidated snapshot instead of whatever queued up while offline
+    publisher.invalidate();
+    sendState(heater.reported());
+}
+
+
+// Publish the oldest journaled frame, at most one per replay interval so a
+// long outage does not flood the broker. A record is only dropped once the
+// publish has succeeded.
+void replayJournal() {
+    EcoSmartJournalEntry entry;
+    if (!connection.connected() || !journal.peek(&entry) ||
+        millis() - lastReplay < JOURNAL_REPLAY_INTERVAL_MS) {
+        return;
+    }
+    lastReplay = millis();
+
+    EcoSmartFrame frame(entry.frame);
+    char message[96];
+    snprintf(message, sizeof(message), "{\"age\":%u,\"mode\":\"%s\",\"flow\":\"%s\",\"temperature\":%u}",
+             lastReplay - entry.millis, frame.on() ? on_mode : off_mode, frame.flow() ? flow_on : flow_off,
+             use_c ? frame.tempC() : frame.tempF());
+    if (client.publish(journal_topic, message)) {
+        journal.pop();
+#if JOURNAL_FLASH
+        journalDirty = true;
+#endif
+    }
+}
+
+
+#if JOURNAL_FLASH
+// Restore a journal saved before the last reset. Its timestamps are from the
+// previous boot, so the newest record is taken to be now.
+void loadJournal() {
+    EEPROM.begin(sizeof(uint32_t) + sizeof(journal));
+    uint32_t magic;
+    EEPROM.get(0, magic);
+    if (magic == JOURNAL_MAGIC) {
+        EEPROM.get(sizeof(magic), journal);
+        journal.rebase(millis());
+        ECOSMART_LOGI("Restored %u journaled frames", journal.records());
+    }
+}
+
+// Write the journal to flash when it has changed, at most once per interval
+// to spare the flash.
+void saveJournal() {
+    if (!journalDirty || millis() - lastJournalSave < JOURNAL_FLASH_INTERVAL_MS) {
+        return;
+    }
+    EEPROM.put(0, static_cast<uint32_t>(JOURNAL_MAGIC));
+    EEPROM.put(sizeof(uint32_t), journal);
+    EEPROM.commit();
+    journalDirty = false;
+    lastJournalSave = millis();
+}
+#endif
+
+
+// Publish the hot-water usage of the interval just closed. An interval that
+// closes while offline is extended until the broker is back.
+void publishUsage() {
+    if (!connection.connected() || !usage.due(millis())) {
+        return;
+    }
+    const EcoSmartUsageSummary &summary = usage.summary();
+    char message[160];
+    snprintf(message, sizeof(message),
+             "{\"interval_s\":%u,\"draws\":%u,\"draw_s\":%u,\"longest_s\":%u,\"duty_pct\":%u.%u,"
+             "\"setpoint\":%u,\"setpoint_min\":%u,\"setpoint_max\":%u}",
+             summary.intervalMs / 1000, summary.draws, summary.drawMs / 1000, summary.longestMs / 1000,
+             summary.dutyPermille / 10, summary.dutyPermille % 10, summary.setpointMean, summary.setpointMin,
+             summary.setpointMax);
+    client.publish(usage_topic, message);
+}
+
+
+// Publish a requested analyzer report, one frame byte per call so a report
+// does not hold up the loop.
+void publishAnalysis() {
+    if (analyzerByte >= ECOSMART_FRAME_BYTES || !connection.connected()) {
+        return;
+    }
+    char message[MQTT_BUFFER_SIZE - 64];
+    if (analyzer.report(analyzerByte, message, sizeof(message)) < sizeof(message)) {
+        client.publish(analyzer_topic, message);
     } else {
-        init &= ~(1ULL << ECOSMART_C_BIT_SHIFT);
-    }
-    cmd = init;
-}
-
-
-void reconnect() {
-    // Loop until we're reconnected
-    while (!client.connected()) {
-        Serial.print("Attempting MQTT connection...");
-        // Attempt to connect
-        if (client.connect(SENSORNAME, mqtt_username, mqtt_password)) {
-            Serial.println("connected");
-            client.subscribe(mode_command_topic);
-            client.subscribe(temperature_command_topic);
-            sendState();
-        } else {
-            Serial.print("failed, rc=");
-            Serial.print(client.state());
-            Serial.println(" try again in 5 seconds");
-            // Wait 5 seconds before retrying
-            delay(5000);
+        ECOSMART_LOGW("analyzer report for byte %u too long", analyzerByte + 1U);
+    }
+    analyzerByte++;
+}
+
+
+static_assert(sizeof(ECOSMART_CAPTURE_PREFIX) + ECOSMART_CAPTURE_MAX_TEXT <= ECOSMART_LOG_LINE,
+              "a capture must fit one log line");
+
+// Log one pending capture of a failed decode, as a single base64 line.
+void writeCapture() {
+    EcoSmartCapture capture;
+    if (!captures.read(&capture)) {
+        return;
+    }
+    uint8_t record[ECOSMART_CAPTURE_MAX_BYTES];
+    char text[ECOSMART_CAPTURE_MAX_TEXT];
+    ecoSmartBase64(record, ecoSmartCaptureEncode(capture, record), text);
+    ECOSMART_LOGI("%s%s", ECOSMART_CAPTURE_PREFIX, text);
+}
+
+
+size_t writeCorpus(const uint8_t *data, size_t len, void *arg) {
+    return static_cast<WiFiClient *>(arg)->write(data, len);
+}
+
+
+// Stream the raw corpus to a connected client, one batch per loop() pass.
+void streamCorpus() {
+    if (CORPUS_PORT == 0) {
+        return;
+    }
+    if (!corpus.recording()) {
+        corpusClient = corpusServer.available();
+        if (!corpusClient) {
+            return;
         }
+        ECOSMART_LOGI("Corpus recording started");
+        corpusClient.setNoDelay(true);
+        receiver.setTap(EcoSmartCorpusRecorder::tap, &corpus);
+        corpus.start();
+    }
+    if (!corpusClient.connected() || !corpus.drain(writeCorpus, &corpusClient)) {
+        receiver.setTap(nullptr);
+        corpus.stop();
+        corpusClient.stop();
+        ECOSMART_LOGI("Corpus recording stopped: %u durations, %u lost", corpus.recorded(), corpus.overflows());
     }
 }
 
 
-void processData(uint64_t data) {
+// Report how the last command fared, as {"result":"retried","attempts":2,
+// "latency_ms":2140}. A failed command never changed the published state.
+void reportDelivery() {
+    EcoSmartDelivery outcome;
+    if (!commander.finished(millis(), &outcome)) {
+        return;
+    }
+    ECOSMART_LOGI("command %s after %u transmissions in %u ms", ecoSmartDeliveryName(outcome),
+                  commander.attempts(), commander.latencyMs());
+    if (!connection.connected()) {
+        return;
+    }
+    char message[80];
+    snprintf(message, sizeof(message), "{\"result\":\"%s\",\"attempts\":%u,\"latency_ms\":%u}",
+             ecoSmartDeliveryName(outcome), commander.attempts(), commander.latencyMs());
+    client.publish(command_result_topic, message);
+}
 
-    cmd = data;
 
-    updateState();
+// Transmit with the widths learned from the heater, refreshed once a minute.
+void adoptTiming() {
+    const EcoSmartDecoder &decoder = receiver.decoder();
+    if (!TX_LEARNED_TIMING || decoder.calibrations() < TX_LEARNED_TIMING_FRAMES ||
+        millis() - lastTiming < STATS_INTERVAL_MS) {
+        return;
+    }
+    lastTiming = millis();
+    heater.setTiming(decoder.transmitTiming());
+}
 
-    Serial.print("data (hex) : ");
-    Serial.println(uint64ToString(results.value, HEX));
-    Serial.print("data (bin) : ");
-    Serial.println(uint64ToString(results.value, BIN));
 
+void processData(uint64_t data) {
 
-    Serial.print("stateOn    : ");
-    Serial.println(stateOn);
+    EcoSmartFrame frame(data);
+    heater.observe(frame, millis());
+    usage.update(frame.flow(), frame.celsius() ? frame.tempC() : frame.tempF(), millis());
+    if (ANALYZE_FRAMES) {
+        analyzer.add(frame);
+    }
 
-    Serial.print("use_c      : ");
-    Serial.println(use_c);
+    if (!connection.connected() && journal.append(data, millis())) {
+#if JOURNAL_FLASH
+        journalDirty = true;
+#endif
+    }
 
-    Serial.print("stateFlow  : ");
-    Serial.println(stateFlow);
+    updateState(frame);
 
-    Serial.print("temp_f     : ");
-    Serial.println(getTempF());
+    ECOSMART_LOGD("data %02X%08X: on %u, use_c %u, flow %u, %uF/%uC", static_cast<uint32_t>(data >> 32),
+                  static_cast<uint32_t>(data), stateOn, use_c, stateFlow, frame.tempF(), frame.tempC());
+#if ECOSMART_LOG_LEVEL >= ECOSMART_LOG_VERBOSE
+    char bits[ECOSMART_BITS + 1];
+    for (uint8_t i = 0; i < ECOSMART_BITS; i++) {
+        bits[i] = (data >> (ECOSMART_BITS - 1 - i)) & 1U ? '1' : '0';
+    }
+    bits[ECOSMART_BITS] = '\0';
+    ECOSMART_LOGV("data (bin) : %s", bits);
+#endif
 
-    Serial.print("temp_c     : ");
-    Serial.println(getTempC());
+    sendState(frame);
+}
 
-    sendState();
 
+// Hand Serial only what fits in its transmit FIFO, so it never blocks.
+size_t writeSerial(const uint8_t *data, size_t len, void *) {
+    size_t room = Serial.availableForWrite();
+    return Serial.write(data, len < room ? len : room);
 }
 
-void loop() {
 
-    if (!client.connected()) {
-        reconnect();
+void logTask(void *) {
+    ecoSmartLog().drain(writeSerial, nullptr);
+}
+
+
+void decodeTask(void *) {
+    EcoSmartFrameRecord frame;
+    while (receiver.read(&frame)) {
+        ECOSMART_LOGD("*** EcoSmart data found at %u us, confidence %u%% ***", frame.micros, frame.confidence);
+        processData(frame.frame);
     }
+}
 
-    if (WiFi.status() != WL_CONNECTED) {
-        delay(1);
-        Serial.print("WIFI disconnected. Attempting reconnection.");
-        setup_wifi();
-        return;
+
+void transmitTask(void *) {
+    transmitCommand();
+    reportDelivery();
+}
+
+
+// Decoding and transmitting carry on while the network is down
+void networkTask(void *) {
+    if (connection.step(millis()) == EcoSmartConnection::CONNECTED) {
+        client.loop();
     }
+}
 
-    client.loop();
 
+void otaTask(void *) {
+    if (!otaStarted && wifiUp()) {
+        ArduinoOTA.begin();
+        otaStarted = true;
+    }
     ArduinoOTA.handle();
+}
 
 
-    if (irrecv.decode(&results)) {
+void udpTask(void *) {
+    if (!udpStarted && wifiUp()) {
+        udp.begin(UDP_PORT);
+        udpStarted = true;
+    }
+    if (udpStarted) {
+        serveUdp();
+    }
+}
 
-        // Blank line between entries
-        Serial.println("Attempting EcoSmart decode");
-        if (results.decode_type == UNKNOWN && decodeEcoSmart(&results)) {
-            Serial.println();
-            Serial.println("*** EcoSmart data found ***");
-            processData(results.value);
-            Serial.println();
 
-        } else {
-            Serial.println("EcoSmart decode FAILED");
+void corpusTask(void *) {
+    streamCorpus();
+}
 
-            Serial.println();
 
-// Display a crude timestamp.
-            uint32_t now = millis();
-            Serial.printf("Timestamp : %06u.%03u\n", now / 1000, now % 1000);
-            if (results.overflow) {
-                Serial.printf("WARNING: IR code is too big for buffer (>= %d). "
-                              "This result shouldn't be trusted until this is resolved. "
-                              "Edit & increase CAPTURE_BUFFER_SIZE.\n",
-                              CAPTURE_BUFFER_SIZE);
-            }
+void publishTask(void *) {
+    publishState();
+    replayJournal();
+}
 
-// Display the basic output of what we found.
-            Serial.print(resultToHumanReadableBasic(&results));
-            yield();  // Feed the WDT as the text output can take a while to print.
 
-// Display the library version the message was captured with.
-            Serial.print("Library   : v");
-            Serial.println(_IRREMOTEESP8266_VERSION_);
-            Serial.println();
+void reportTask(void *) {
+    publishStats();
+    publishUsage();
+    publishAnalysis();
+    adoptTiming();
+#if JOURNAL_FLASH
+    saveJournal();
+#endif
+}
 
-// Output RAW timing info of the result.
-            Serial.println(resultToTimingInfo(&results));
-            yield();  // Feed the WDT (again)
 
-// Output the results as source code
-            Serial.println(resultToSourceCode(&results));
-            yield();  // Feed the WDT (again)
+void diagnosticsTask(void *) {
+    uint32_t failures = receiver.decoder().failures();
+    if (failures != lastFailures) {
+        lastFailures = failures;
+        ECOSMART_LOGW("EcoSmart decode FAILED, total failures: %u", failures);
+    }
+    writeCapture();
 
-        }
+    uint32_t overflows = receiver.overflows();
+    if (overflows != lastOverflows) {
+        lastOverflows = overflows;
+        ECOSMART_LOGW("EcoSmart frame queue overflowed, frames dropped: %u", overflows);
     }
+}
 
+
+// Decoded frames come first so the receive queue never backs up; logging and
+// publishing can wait a pass when the others ran long. Budgets are in us and
+// only flag overruns in the task stats.
+void setupTasks() {
+    tasks.add("decode", decodeTask, nullptr, 0, ECOSMART_PRIORITY_HIGH, 5000);
+    tasks.add("transmit", transmitTask, nullptr, 0, ECOSMART_PRIORITY_HIGH, 1000);
+    tasks.add("network", networkTask, nullptr, 0, ECOSMART_PRIORITY_NORMAL, 5000);
+    if (UDP_PORT != 0) {
+        tasks.add("udp", udpTask, nullptr, 0, ECOSMART_PRIORITY_NORMAL, 2000);
+    }
+    tasks.add("ota", otaTask, nullptr, 0, ECOSMART_PRIORITY_NORMAL, 2000);
+    tasks.add("corpus", corpusTask, nullptr, 0, ECOSMART_PRIORITY_NORMAL, 2000);
+    tasks.add("publish", publishTask, nullptr, 0, ECOSMART_PRIORITY_LOW, 5000);
+    tasks.add("report", reportTask, nullptr, 100, ECOSMART_PRIORITY_LOW, 10000);
+    tasks.add("diagnostics", diagnosticsTask, nullptr, 0, ECOSMART_PRIORITY_LOW, 5000);
+    tasks.add("log", logTask, nullptr, 0, ECOSMART_PRIORITY_LOW, 500);
 }
 
+
+void loop() {
+    uint32_t loopStart = micros();
+    tasks.run(millis());
+    loopStats.add(micros() - loopStart);
+}
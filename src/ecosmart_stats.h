@@ -0,0 +1,89 @@
+//
+// Cheap timing statistics for production builds.
+//
+// A histogram is an array of counters with one power-of-two bucket per
+// duration range, so adding a sample is a count-leading-zeros and three
+// increments. Both firmwares keep one for loop() and one for starting a
+// transmission, and report them (with the decoder's counters) periodically.
+//
+// Usage:
+//   uint32_t start = micros();
+//   ...
+//   loopStats.add(micros() - start);
+//   loopStats.max(); loopStats.percentile(99); loopStats.reset();
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_STATS_H
+#define ECOSMART_NODEMCU_ECOSMART_STATS_H
+
+
+#include <stdint.h>
+
+
+#define ECOSMART_HISTOGRAM_BUCKETS  20U     // bucket i holds [2^i, 2^(i+1)) us, the last anything longer
+
+
+class EcoSmartHistogram {
+public:
+    void add(uint32_t us) {
+        uint8_t bucket = us == 0 ? 0 : static_cast<uint8_t>(31 - __builtin_clz(us));
+        if (bucket >= ECOSMART_HISTOGRAM_BUCKETS) {
+            bucket = ECOSMART_HISTOGRAM_BUCKETS - 1;
+        }
+        _buckets[bucket]++;
+        _count++;
+        _total += us;
+        if (us > _max) {
+            _max = us;
+        }
+    }
+
+    uint32_t count() const {
+        return _count;
+    }
+
+    uint32_t max() const {
+        return _max;
+    }
+
+    uint32_t mean() const {
+        return _count == 0 ? 0 : static_cast<uint32_t>(_total / _count);
+    }
+
+    // Upper bound of the bucket holding the given percentile, capped at max().
+    uint32_t percentile(uint8_t percent) const {
+        uint64_t wanted = (static_cast<uint64_t>(_count) * percent + 99) / 100;
+        uint32_t seen = 0;
+        for (uint8_t i = 0; i < ECOSMART_HISTOGRAM_BUCKETS; i++) {
+            seen += _buckets[i];
+            if (seen != 0 && seen >= wanted) {
+                uint32_t bound = (2UL << i) - 1;
+                return bound < _max ? bound : _max;
+            }
+        }
+        return _max;
+    }
+
+    uint32_t bucket(uint8_t i) const {
+        return i < ECOSMART_HISTOGRAM_BUCKETS ? _buckets[i] : 0;
+    }
+
+    // Start a new reporting period.
+    void reset() {
+        for (uint8_t i = 0; i < ECOSMART_HISTOGRAM_BUCKETS; i++) {
+            _buckets[i] = 0;
+        }
+        _count = 0;
+        _total = 0;
+        _max = 0;
+    }
+
+private:
+    uint32_t _buckets[ECOSMART_HISTOGRAM_BUCKETS] = {};
+    uint32_t _count = 0;
+    uint64_t _total = 0;
+    uint32_t _max = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_STATS_H
@@ -0,0 +1,157 @@
+//
+// Cooperative task list for loop().
+//
+// Each subsystem is a task with a period, a priority and a time budget. A
+// pass of run() calls the due tasks highest priority first and measures each
+// one. High and normal priority tasks run whenever they are due; low priority
+// ones (logging, publishing) are put off to a later pass once the pass has
+// used up its slice, but never more than ECOSMART_TASK_MAX_DEFERRALS passes
+// in a row. Everything is allocated up front: N tasks, no heap.
+//
+// Usage:
+//   EcoSmartTasks<8> tasks(LOOP_SLICE_US);
+//   tasks.add("decode", decodeTask, nullptr, 0, ECOSMART_PRIORITY_HIGH, 2000);   // setup()
+//   tasks.run(millis());                                                         // loop()
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_TASKS_H
+#define ECOSMART_NODEMCU_ECOSMART_TASKS_H
+
+
+#include <stdint.h>
+#include "ecosmart_compat.h"
+
+
+#define ECOSMART_TASK_MAX_DEFERRALS   8U    // passes a low priority task can be put off in a row
+
+
+enum EcoSmartPriority : uint8_t {
+    ECOSMART_PRIORITY_HIGH,
+    ECOSMART_PRIORITY_NORMAL,
+    ECOSMART_PRIORITY_LOW,          // deferrable
+};
+
+
+typedef void (*EcoSmartTaskFn)(void *arg);
+
+
+struct EcoSmartTaskStats {
+    const char *name;
+    uint32_t runs;
+    uint32_t meanUs;
+    uint32_t maxUs;
+    uint32_t overruns;              // runs longer than the task's budget
+    uint32_t deferrals;             // passes it was due but put off
+};
+
+
+template<uint8_t N>
+class EcoSmartTasks {
+public:
+    // Args:
+    //   sliceUs: Once a pass has taken this long, low priority tasks wait.
+    explicit EcoSmartTasks(uint32_t sliceUs) : _slice(sliceUs) {}
+
+    // Register a task. Tasks of equal priority run in the order added.
+    //
+    // Args:
+    //   name: Shown in stats(), must outlive the task list.
+    //   fn: Called with arg when the task is due.
+    //   periodMs: Least time between two runs, 0 to run on every pass.
+    //   priority: ECOSMART_PRIORITY_HIGH, _NORMAL or _LOW.
+    //   budgetUs: Runs taking longer count as overruns.
+    // Returns:
+    //   False if N tasks are already registered.
+    bool add(const char *name, EcoSmartTaskFn fn, void *arg, uint32_t periodMs, EcoSmartPriority priority,
+             uint32_t budgetUs) {
+        if (_count >= N) {
+            return false;
+        }
+        uint8_t i = _count++;
+        for (; i > 0 && _tasks[i - 1].priority > priority; i--) {
+            _tasks[i] = _tasks[i - 1];
+        }
+        _tasks[i] = Task{name, fn, arg, periodMs, priority, budgetUs, 0, 0, false, 0, 0, 0, 0, 0};
+        return true;
+    }
+
+    // Run one pass over the due tasks.
+    void run(uint32_t nowMs) {
+        uint32_t start = micros();
+        for (uint8_t i = 0; i < _count; i++) {
+            Task &task = _tasks[i];
+            if (task.ran && nowMs - task.lastRun < task.period) {
+                continue;
+            }
+            uint32_t taskStart = micros();
+            if (task.priority == ECOSMART_PRIORITY_LOW && taskStart - start >= _slice &&
+                task.deferred < ECOSMART_TASK_MAX_DEFERRALS) {
+                task.deferred++;
+                task.deferrals++;
+                continue;
+            }
+
+            task.fn(task.arg);
+
+            uint32_t us = micros() - taskStart;
+            task.ran = true;
+            task.lastRun = nowMs;
+            task.deferred = 0;
+            task.runs++;
+            task.totalUs += us;
+            if (us > task.maxUs) {
+                task.maxUs = us;
+            }
+            if (us > task.budget) {
+                task.overruns++;
+            }
+        }
+    }
+
+    uint8_t count() const {
+        return _count;
+    }
+
+    // Measurements for task i (in run order) since the last resetStats().
+    EcoSmartTaskStats stats(uint8_t i) const {
+        const Task &task = _tasks[i < _count ? i : 0];
+        return {task.name, task.runs, task.runs == 0 ? 0 : static_cast<uint32_t>(task.totalUs / task.runs),
+                task.maxUs, task.overruns, task.deferrals};
+    }
+
+    void resetStats() {
+        for (uint8_t i = 0; i < _count; i++) {
+            Task &task = _tasks[i];
+            task.runs = 0;
+            task.totalUs = 0;
+            task.maxUs = 0;
+            task.overruns = 0;
+            task.deferrals = 0;
+        }
+    }
+
+private:
+    struct Task {
+        const char *name;
+        EcoSmartTaskFn fn;
+        void *arg;
+        uint32_t period;
+        EcoSmartPriority priority;
+        uint32_t budget;
+        uint32_t lastRun;
+        uint8_t deferred;           // passes put off in a row
+        bool ran;
+        uint32_t runs;
+        uint64_t totalUs;
+        uint32_t maxUs;
+        uint32_t overruns;
+        uint32_t deferrals;
+    };
+
+    uint32_t _slice;
+    Task _tasks[N] = {};
+    uint8_t _count = 0;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_TASKS_H
@@ -0,0 +1,110 @@
+//
+// Fixed-point setpoints: temperatures in tenths of a degree, paired and
+// clamped through lookup tables.
+//
+// The heater wants every setpoint in both scales (byte 4 in F, byte 5 in C)
+// and only accepts 80-140F / 27-60C. The ESP8266 has neither an FPU nor a
+// hardware divider, so rather than convert with soft-float and round, each
+// whole degree in range is looked up in a table of its counterpart. Inputs
+// are in tenths of a degree, as parsed by ecoSmartParseTenths(), and are
+// rounded to the nearest whole degree (halves away from zero) in their own
+// scale first; the other scale is that degree's counterpart. This is how the
+// heater's panel pairs them, but a fractional command can come out one degree
+// off what converting the fraction did: 26.5C is now 81F/27C (was 80F/27C)
+// and 83.3F is 83F/28C (was 83F/29C).
+//
+// Usage:
+//   EcoSmartSetpoint setpoint = use_c ? ecoSmartSetpointC(415) : ecoSmartSetpointF(1055);
+//   cmd.setTempF(setpoint.f);
+//   cmd.setTempC(setpoint.c);
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_TEMPERATURE_H
+#define ECOSMART_NODEMCU_ECOSMART_TEMPERATURE_H
+
+
+#include <stdint.h>
+
+
+#define ECOSMART_TEMP_F_MIN          80     // the heater's setpoint range
+#define ECOSMART_TEMP_F_MAX         140
+#define ECOSMART_TEMP_C_MIN          27
+#define ECOSMART_TEMP_C_MAX          60
+#define ECOSMART_COMMAND_TENTHS_MIN -9999   // temperature commands taken (in tenths), then clamped to the range
+#define ECOSMART_COMMAND_TENTHS_MAX  9999
+
+
+struct EcoSmartSetpoint {
+    uint8_t f;
+    uint8_t c;
+};
+
+
+// round((f - 32) / 1.8) for f in [ECOSMART_TEMP_F_MIN, ECOSMART_TEMP_F_MAX]
+static constexpr uint8_t ECOSMART_C_FOR_F[ECOSMART_TEMP_F_MAX - ECOSMART_TEMP_F_MIN + 1] = {
+        27, 27, 28, 28, 29, 29, 30, 31, 31, 32, 32, 33, 33, 34, 34, 35, 36, 36, 37, 37, 38,
+        38, 39, 39, 40, 41, 41, 42, 42, 43, 43, 44, 44, 45, 46, 46, 47, 47, 48, 48, 49,
+        49, 50, 51, 51, 52, 52, 53, 53, 54, 54, 55, 56, 56, 57, 57, 58, 58, 59, 59, 60};
+
+// round(c * 1.8 + 32) for c in [ECOSMART_TEMP_C_MIN, ECOSMART_TEMP_C_MAX]
+static constexpr uint8_t ECOSMART_F_FOR_C[ECOSMART_TEMP_C_MAX - ECOSMART_TEMP_C_MIN + 1] = {
+        81, 82, 84, 86, 88, 90, 91, 93, 95, 97, 99, 100, 102, 104, 106, 108, 109,
+        111, 113, 115, 117, 118, 120, 122, 124, 126, 127, 129, 131, 133, 135, 136, 138, 140};
+
+
+// Whole degrees from tenths, halves away from zero.
+constexpr int32_t ecoSmartRoundTenths(int32_t tenths) {
+    return tenths >= 0 ? (tenths + 5) / 10 : -((5 - tenths) / 10);
+}
+
+// The setpoint for a temperature in tenths of a degree F, clamped to the
+// heater's range.
+inline EcoSmartSetpoint ecoSmartSetpointF(int32_t tenths) {
+    int32_t f = ecoSmartRoundTenths(tenths);
+    if (f < ECOSMART_TEMP_F_MIN) {
+        f = ECOSMART_TEMP_F_MIN;
+    } else if (f > ECOSMART_TEMP_F_MAX) {
+        f = ECOSMART_TEMP_F_MAX;
+    }
+    return {static_cast<uint8_t>(f), ECOSMART_C_FOR_F[f - ECOSMART_TEMP_F_MIN]};
+}
+
+// The setpoint for a temperature in tenths of a degree C. Out of range it is
+// clamped in F, like the heater's own panel: anything below 27C is 80F/27C.
+inline EcoSmartSetpoint ecoSmartSetpointC(int32_t tenths) {
+    int32_t c = ecoSmartRoundTenths(tenths);
+    if (c < ECOSMART_TEMP_C_MIN) {
+        return ecoSmartSetpointF(ECOSMART_TEMP_F_MIN * 10);
+    }
+    if (c > ECOSMART_TEMP_C_MAX) {
+        return ecoSmartSetpointF(ECOSMART_TEMP_F_MAX * 10);
+    }
+    return {ECOSMART_F_FOR_C[c - ECOSMART_TEMP_C_MIN], static_cast<uint8_t>(c)};
+}
+
+
+static_assert(ecoSmartRoundTenths(415) == 42 && ecoSmartRoundTenths(414) == 41 &&
+              ecoSmartRoundTenths(-35) == -4 && ecoSmartRoundTenths(-34) == -3, "halves round away from zero");
+
+#if __cplusplus >= 201402L
+// The tables match the integer forms of the conversions (no exact halves
+// occur, as 1.8 = 9/5).
+constexpr bool ecoSmartTemperatureTablesMatch() {
+    for (int32_t f = ECOSMART_TEMP_F_MIN; f <= ECOSMART_TEMP_F_MAX; f++) {
+        if (ECOSMART_C_FOR_F[f - ECOSMART_TEMP_F_MIN] != (5 * (f - 32) + 4) / 9) {
+            return false;
+        }
+    }
+    for (int32_t c = ECOSMART_TEMP_C_MIN; c <= ECOSMART_TEMP_C_MAX; c++) {
+        if (ECOSMART_F_FOR_C[c - ECOSMART_TEMP_C_MIN] != (9 * c + 160 + 2) / 5) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(ecoSmartTemperatureTablesMatch(), "F/C tables must hold the rounded conversions");
+#endif
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_TEMPERATURE_H
@@ -0,0 +1,280 @@
+//
+// Non-blocking, timer driven EcoSmart transmitter.
+//
+// A frame is encoded into an EcoSmartWaveform up front and then played back
+// from the ESP8266 timer1 interrupt, so loop() keeps running (MQTT, OTA and
+// receiving) while the 100+ ms of waveform goes out on the wire.
+//
+// NOTE: this claims timer1, which is also used by the Arduino core's
+// analogWrite()/tone() waveform generator. Do not use those alongside it.
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_TX_H
+#define ECOSMART_NODEMCU_ECOSMART_TX_H
+
+
+#include <stdint.h>
+#include "ecosmart_compat.h"
+#include "ecosmart_protocol.h"
+#include "ecosmart_waveform.h"
+
+
+#ifdef ARDUINO
+
+namespace ecosmart_timer {
+
+#define ECOSMART_TIMER_TICKS_PER_US 5U  // 80 MHz APB / TIM_DIV16
+
+inline void attach(void (*isr)()) {
+    timer1_isr_init();
+    timer1_attachInterrupt(isr);
+}
+
+inline void start() {
+    timer1_enable(TIM_DIV16, TIM_EDGE, TIM_SINGLE);
+}
+
+inline void IRAM_ATTR arm(uint32_t us) {
+    timer1_write(us * ECOSMART_TIMER_TICKS_PER_US);
+}
+
+inline void IRAM_ATTR stop() {
+    timer1_disable();
+}
+
+inline void IRAM_ATTR writePin(uint8_t pin, uint8_t level) {
+    digitalWrite(pin, level);
+}
+
+}  // namespace ecosmart_timer
+
+#else  // ARDUINO
+
+// Host-side stand-in for timer1 and the output pin, used to check the
+// generated waveform against the protocol table without a board attached.
+//
+// Usage:
+//   tx.send(data, 40, 0);
+//   uint8_t level; uint32_t us;
+//   while (EcoSmartMockTimer::instance().step(&level, &us)) { ... }
+class EcoSmartMockTimer {
+public:
+    static EcoSmartMockTimer &instance() {
+        static EcoSmartMockTimer timer;
+        return timer;
+    }
+
+    // Play the armed interval: report the pin level held during it and its
+    // length, then fire the interrupt. Returns false once the timer is stopped.
+    bool step(uint8_t *level, uint32_t *us) {
+        if (!armed || isr == nullptr) {
+            return false;
+        }
+        *level = pinLevel;
+        *us = armedUs;
+        armed = false;
+        isr();
+        return true;
+    }
+
+    void (*isr)() = nullptr;
+    bool running = false;
+    bool armed = false;
+    uint32_t armedUs = 0;
+    uint8_t pinLevel = 0;
+};
+
+namespace ecosmart_timer {
+
+inline void attach(void (*isr)()) {
+    EcoSmartMockTimer::instance().isr = isr;
+}
+
+inline void start() {
+    EcoSmartMockTimer::instance().running = true;
+}
+
+inline void arm(uint32_t us) {
+    EcoSmartMockTimer &timer = EcoSmartMockTimer::instance();
+    timer.armedUs = us;
+    timer.armed = timer.running;
+}
+
+inline void stop() {
+    EcoSmartMockTimer &timer = EcoSmartMockTimer::instance();
+    timer.running = false;
+    timer.armed = false;
+}
+
+inline void writePin(uint8_t pin, uint8_t level) {
+    digitalWrite(pin, level);
+    EcoSmartMockTimer::instance().pinLevel = level;
+}
+
+}  // namespace ecosmart_timer
+
+#endif  // ARDUINO
+
+
+// Called from loop() context once a transmission (including its repeats) has
+// completely left the wire.
+typedef void (*EcoSmartTxCallback)(uint64_t data, void *arg);
+
+
+class EcoSmartTransmitter {
+public:
+    void begin(uint8_t pin) {
+        _pin = pin;
+        pinMode(_pin, OUTPUT);
+        ecosmart_timer::writePin(_pin, LOW_LEVEL);
+        active() = this;
+        ecosmart_timer::attach(&EcoSmartTransmitter::isr);
+    }
+
+    // Move the transmitter to another pin, so one timer can take turns driving
+    // several heaters. Returns false (and stays put) while a transmission is
+    // in progress.
+    bool setPin(uint8_t pin) {
+        if (_busy) {
+            return false;
+        }
+        if (pin != _pin) {
+            pinMode(pin, OUTPUT);
+            ecosmart_timer::writePin(pin, LOW_LEVEL);
+            _pin = pin;
+        }
+        return true;
+    }
+
+    // Transmit with these widths from the next send(data, ...) on, e.g. the
+    // ones the decoder learned from the heater.
+    void setTiming(const EcoSmartTiming &timing) {
+        if (timing != _timing) {
+            _timing = timing;
+            _cache.len = 0;
+        }
+    }
+
+    void onDone(EcoSmartTxCallback callback, void *arg = nullptr) {
+        _callback = callback;
+        _callbackArg = arg;
+    }
+
+    // Start sending an EcoSmart packet in the background.
+    //
+    // The last encoded command is cached, so resending the same data (the
+    // common case for repeats and retransmits) skips the encoder entirely.
+    //
+    // Args:
+    //   data: The data we want to send. MSB first.
+    //   nbits: The number of bits of data to send. (Typically 40)
+    //   repeat: The nr. of times the message should be repeated.
+    // Returns:
+    //   boolean: False if a transmission is already in progress.
+    bool send(uint64_t data, uint16_t nbits, uint16_t repeat) {
+        if (_busy) {
+            return false;
+        }
+        if (!_cache.valid() || _cache.data != data || _cache.bits != nbits) {
+            _cache.set(data, nbits, _timing);
+        }
+        return send(_cache, repeat);
+    }
+
+    // Start sending a pre-encoded waveform in the background. The waveform is
+    // played in place, so it must stay alive until the transmission is done.
+    bool send(const EcoSmartWaveform &wave, uint16_t repeat) {
+        if (_busy || !wave.valid()) {
+            return false;
+        }
+
+        _durations = wave.durations;
+        _data = wave.data;
+        _len = wave.len;
+        _pos = 0;
+        _repeat = repeat;
+        _done = false;
+        _busy = true;
+        _startedAt = micros();
+
+        ecosmart_timer::start();
+        step();
+        return true;
+    }
+
+    bool busy() const {
+        return _busy;
+    }
+
+    // True once after each completed transmission.
+    bool done() {
+        if (!_done) {
+            return false;
+        }
+        _done = false;
+        return true;
+    }
+
+    // How long the last completed transmission took on the wire, in us.
+    uint32_t airtimeUs() const {
+        return _airtime;
+    }
+
+    // Dispatch the completion callback. Call this from loop().
+    void loop() {
+        if (done() && _callback != nullptr) {
+            _callback(_data, _callbackArg);
+        }
+    }
+
+private:
+    static const uint8_t LOW_LEVEL = 0;
+    static const uint8_t HIGH_LEVEL = 1;
+
+    static EcoSmartTransmitter *&active() {
+        static EcoSmartTransmitter *transmitter = nullptr;
+        return transmitter;
+    }
+
+    static void IRAM_ATTR isr() {
+        active()->step();
+    }
+
+    // Put the next waveform entry on the wire and arm the timer for its length.
+    void IRAM_ATTR step() {
+        if (_pos == _len) {
+            if (_repeat == 0) {
+                ecosmart_timer::writePin(_pin, LOW_LEVEL);
+                ecosmart_timer::stop();
+                _airtime = micros() - _startedAt;
+                _busy = false;
+                _done = true;
+                return;
+            }
+            _repeat--;
+            _pos = 0;
+        }
+
+        // even entries are marks, odd entries are spaces
+        ecosmart_timer::writePin(_pin, (_pos & 1U) ? LOW_LEVEL : HIGH_LEVEL);
+        ecosmart_timer::arm(_durations[_pos++]);
+    }
+
+    uint8_t _pin = 0;
+    EcoSmartWaveform _cache = {};
+    EcoSmartTiming _timing = EcoSmartTiming::nominal();
+    const uint16_t *_durations = nullptr;
+    uint64_t _data = 0;
+    volatile uint16_t _len = 0;
+    volatile uint16_t _pos = 0;
+    volatile uint16_t _repeat = 0;
+    volatile bool _busy = false;
+    volatile bool _done = false;
+    uint32_t _startedAt = 0;
+    volatile uint32_t _airtime = 0;
+    EcoSmartTxCallback _callback = nullptr;
+    void *_callbackArg = nullptr;
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_TX_H
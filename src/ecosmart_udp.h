@@ -0,0 +1,134 @@
+//
+// Direct UDP command channel: fixed-size binary messages for controllers on
+// the same LAN that cannot wait for a round trip through the MQTT broker.
+//
+// A request is 8 bytes, all multi-byte fields big-endian:
+//
+//   "ES"    magic
+//   uint8   format version (ECOSMART_UDP_VERSION)
+//   uint8   type, EcoSmartUdpType
+//   uint16  sequence, echoed in the reply
+//   int16   value: 0 (off) or 1 (heat) to set the mode, the setpoint in
+//           tenths of a degree in the scale the heater displays (rejected
+//           outside ECOSMART_COMMAND_TENTHS_MIN..MAX, as on MQTT), 0 for a
+//           query
+//
+// and is answered with a 12 byte reply:
+//
+//   "ES"    magic
+//   uint8   format version
+//   uint8   the request's type | ECOSMART_UDP_REPLY
+//   uint16  the request's sequence
+//   uint8   status, EcoSmartUdpStatus
+//   5 bytes the remote's command frame after the request, as on the wire
+//
+// A reply means the command was accepted, not yet confirmed by the heater;
+// confirmation is reported on MQTT as usual. Anything without the magic and
+// version, or of the wrong length, is dropped without a reply.
+// tools/ecosmart_udp.cpp is a client.
+//
+// Usage:
+//   EcoSmartUdpRequest request;
+//   if (ecoSmartUdpDecodeRequest(packet, len, &request)) {
+//       EcoSmartUdpReply reply{request.type, request.sequence, handle(request), cmd};
+//       ecoSmartUdpEncodeReply(reply, out);
+//   }
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_UDP_H
+#define ECOSMART_NODEMCU_ECOSMART_UDP_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ecosmart_frame.h"
+
+
+#define ECOSMART_UDP_MAGIC_0        'E'
+#define ECOSMART_UDP_MAGIC_1        'S'
+#define ECOSMART_UDP_VERSION        1U
+#define ECOSMART_UDP_REQUEST_BYTES  8U
+#define ECOSMART_UDP_REPLY_BYTES   (7U + ECOSMART_FRAME_BYTES)
+#define ECOSMART_UDP_REPLY       0x80U      // set in a reply's type
+#define ECOSMART_UDP_BATCH          4U      // requests handled per loop() pass
+
+
+enum EcoSmartUdpType : uint8_t {
+    ECOSMART_UDP_SET_MODE = 1,
+    ECOSMART_UDP_SET_TEMPERATURE = 2,
+    ECOSMART_UDP_QUERY = 3,
+};
+
+enum EcoSmartUdpStatus : uint8_t {
+    ECOSMART_UDP_ACCEPTED,
+    ECOSMART_UDP_REJECTED,          // a value out of range
+    ECOSMART_UDP_UNKNOWN,           // a type this remote does not handle
+};
+
+
+struct EcoSmartUdpRequest {
+    uint8_t type;
+    uint16_t sequence;
+    int16_t value;
+};
+
+struct EcoSmartUdpReply {
+    uint8_t type;                   // the request's, without ECOSMART_UDP_REPLY
+    uint16_t sequence;
+    uint8_t status;
+    EcoSmartFrame frame;
+};
+
+
+inline void ecoSmartUdpEncodeRequest(const EcoSmartUdpRequest &request, uint8_t out[ECOSMART_UDP_REQUEST_BYTES]) {
+    uint16_t value = static_cast<uint16_t>(request.value);
+    out[0] = ECOSMART_UDP_MAGIC_0;
+    out[1] = ECOSMART_UDP_MAGIC_1;
+    out[2] = ECOSMART_UDP_VERSION;
+    out[3] = request.type;
+    out[4] = static_cast<uint8_t>(request.sequence >> 8);
+    out[5] = static_cast<uint8_t>(request.sequence);
+    out[6] = static_cast<uint8_t>(value >> 8);
+    out[7] = static_cast<uint8_t>(value);
+}
+
+// Returns:
+//   False if in is not a request of this version.
+inline bool ecoSmartUdpDecodeRequest(const uint8_t *in, size_t len, EcoSmartUdpRequest *request) {
+    if (len != ECOSMART_UDP_REQUEST_BYTES || in[0] != ECOSMART_UDP_MAGIC_0 || in[1] != ECOSMART_UDP_MAGIC_1 ||
+        in[2] != ECOSMART_UDP_VERSION || (in[3] & ECOSMART_UDP_REPLY) != 0) {
+        return false;
+    }
+    request->type = in[3];
+    request->sequence = static_cast<uint16_t>(in[4] << 8 | in[5]);
+    request->value = static_cast<int16_t>(static_cast<uint16_t>(in[6] << 8 | in[7]));
+    return true;
+}
+
+inline void ecoSmartUdpEncodeReply(const EcoSmartUdpReply &reply, uint8_t out[ECOSMART_UDP_REPLY_BYTES]) {
+    out[0] = ECOSMART_UDP_MAGIC_0;
+    out[1] = ECOSMART_UDP_MAGIC_1;
+    out[2] = ECOSMART_UDP_VERSION;
+    out[3] = static_cast<uint8_t>(reply.type | ECOSMART_UDP_REPLY);
+    out[4] = static_cast<uint8_t>(reply.sequence >> 8);
+    out[5] = static_cast<uint8_t>(reply.sequence);
+    out[6] = reply.status;
+    reply.frame.toBytes(out + 7);
+}
+
+// Returns:
+//   False if in is not a reply of this version.
+inline bool ecoSmartUdpDecodeReply(const uint8_t *in, size_t len, EcoSmartUdpReply *reply) {
+    if (len != ECOSMART_UDP_REPLY_BYTES || in[0] != ECOSMART_UDP_MAGIC_0 || in[1] != ECOSMART_UDP_MAGIC_1 ||
+        in[2] != ECOSMART_UDP_VERSION || (in[3] & ECOSMART_UDP_REPLY) == 0) {
+        return false;
+    }
+    reply->type = static_cast<uint8_t>(in[3] & ~ECOSMART_UDP_REPLY);
+    reply->sequence = static_cast<uint16_t>(in[4] << 8 | in[5]);
+    reply->status = in[6];
+    reply->frame = EcoSmartFrame::fromBytes(in + 7);
+    return true;
+}
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_UDP_H
@@ -0,0 +1,128 @@
+//
+// Hot-water usage aggregated from flow transitions.
+//
+// Rather than publish every flow ON/OFF and leave Home Assistant to scan the
+// history, EcoSmartUsage folds each decoded frame into running totals in
+// constant time and hands out one summary per interval: number of draws,
+// total and longest draw time, duty cycle, and the setpoint in effect while
+// water was flowing.
+//
+// Usage:
+//   usage.update(cmd.flow(), temperature, millis());   // on every frame
+//   if (usage.due(millis())) { publish usage.summary() ... }
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_USAGE_H
+#define ECOSMART_NODEMCU_ECOSMART_USAGE_H
+
+
+#include <stdint.h>
+
+
+#define ECOSMART_USAGE_MAX_GAP_MS   60000U  // longer without a frame and the time is not counted
+
+
+struct EcoSmartUsageSummary {
+    uint32_t intervalMs;
+    uint16_t draws;             // draws that started in the interval
+    uint32_t drawMs;            // time water was flowing
+    uint32_t longestMs;         // longest draw that ended (or is still running) in the interval
+    uint16_t dutyPermille;      // drawMs per thousand of intervalMs
+    uint8_t setpointMean;       // time-weighted over drawMs, 0 without any flow
+    uint8_t setpointMin;
+    uint8_t setpointMax;
+};
+
+
+class EcoSmartUsage {
+public:
+    explicit EcoSmartUsage(uint32_t intervalMs) : _interval(intervalMs) {}
+
+    // Fold in the state reported by a frame.
+    void update(bool flow, uint8_t setpoint, uint32_t nowMs) {
+        if (!_started) {
+            _started = true;
+            _intervalStart = nowMs;
+            _last = nowMs;
+        }
+        advance(nowMs);
+
+        if (flow && !_flow) {
+            _draws++;
+            _drawMs = 0;
+        } else if (!flow && _flow && _drawMs > _longest) {
+            _longest = _drawMs;
+        }
+        if (flow) {
+            if (_setpointMin == 0 || setpoint < _setpointMin) _setpointMin = setpoint;
+            if (setpoint > _setpointMax) _setpointMax = setpoint;
+        }
+        _flow = flow;
+        _setpoint = setpoint;
+    }
+
+    // True when an interval has closed; its figures are then in summary().
+    bool due(uint32_t nowMs) {
+        if (!_started || nowMs - _intervalStart < _interval) {
+            return false;
+        }
+        advance(nowMs);
+
+        _summary.intervalMs = nowMs - _intervalStart;
+        _summary.draws = _draws;
+        _summary.drawMs = _flowMs;
+        _summary.longestMs = _flow && _drawMs > _longest ? _drawMs : _longest;
+        _summary.dutyPermille = static_cast<uint16_t>(static_cast<uint64_t>(_flowMs) * 1000 / _summary.intervalMs);
+        _summary.setpointMean = _flowMs == 0 ? 0 : static_cast<uint8_t>((_setpointMs + _flowMs / 2) / _flowMs);
+        _summary.setpointMin = _setpointMin;
+        _summary.setpointMax = _setpointMax;
+
+        // a draw still running carries over into the next interval
+        _intervalStart = nowMs;
+        _draws = 0;
+        _flowMs = 0;
+        _longest = 0;
+        _setpointMs = 0;
+        _setpointMin = _flow ? _setpoint : 0;
+        _setpointMax = _flow ? _setpoint : 0;
+        return true;
+    }
+
+    // The last closed interval.
+    const EcoSmartUsageSummary &summary() const {
+        return _summary;
+    }
+
+private:
+    // Credit the time since the last frame to the state that frame reported.
+    void advance(uint32_t nowMs) {
+        uint32_t elapsed = nowMs - _last;
+        _last = nowMs;
+        if (!_flow || elapsed > ECOSMART_USAGE_MAX_GAP_MS) {
+            return;
+        }
+        _flowMs += elapsed;
+        _drawMs += elapsed;
+        _setpointMs += static_cast<uint64_t>(_setpoint) * elapsed;
+    }
+
+    uint32_t _interval;
+    bool _started = false;
+    uint32_t _intervalStart = 0;
+    uint32_t _last = 0;
+    bool _flow = false;
+    uint8_t _setpoint = 0;
+    uint32_t _drawMs = 0;       // length of the current (or last) draw so far
+
+    uint16_t _draws = 0;
+    uint32_t _flowMs = 0;
+    uint32_t _longest = 0;
+    uint64_t _setpointMs = 0;
+    uint8_t _setpointMin = 0;
+    uint8_t _setpointMax = 0;
+
+    EcoSmartUsageSummary _summary = {};
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_USAGE_H
@@ -0,0 +1,92 @@
+//
+// EcoSmart frame encoder.
+//
+// Turns a command into the table of mark/space durations that goes out on
+// the wire. The table is built once per command and replayed as-is for every
+// repeat and retransmit, so the transmit path does no per-bit work. When the
+// command is a compile-time constant the table can be built by the compiler:
+//
+//   static constexpr EcoSmartWaveform initial = EcoSmartWaveform::encode(INITIAL_COMMAND);
+//
+
+#ifndef ECOSMART_NODEMCU_ECOSMART_WAVEFORM_H
+#define ECOSMART_NODEMCU_ECOSMART_WAVEFORM_H
+
+
+#include <stdint.h>
+#include "ecosmart_protocol.h"
+
+
+// header mark + header space + one mark and one space per bit
+#define ECOSMART_MAX_EDGES          (2 + 2 * ECOSMART_MAX_BITS)
+
+// Loops in constexpr functions need C++14; older toolchains still get a
+// plain (run-time) encoder.
+#if __cplusplus >= 201402L
+#define ECOSMART_CONSTEXPR14 constexpr
+#else
+#define ECOSMART_CONSTEXPR14 inline
+#endif
+
+
+struct EcoSmartWaveform {
+    uint64_t data;
+    uint16_t bits;
+    uint16_t len;   // number of valid entries in durations, 0 if invalid
+    uint16_t durations[ECOSMART_MAX_EDGES];  // even entries are marks, odd are spaces
+
+    // Encode a frame.
+    //
+    // Args:
+    //   data: The data we want to send. MSB first.
+    //   nbits: The number of bits of data to send. (Typically 40)
+    //   timing: Mark and space widths to use.
+    // Returns:
+    //   The waveform, with len == 0 if nbits is out of range.
+    static ECOSMART_CONSTEXPR14 EcoSmartWaveform encode(uint64_t data, uint16_t nbits = ECOSMART_BITS,
+                                                        const EcoSmartTiming &timing = EcoSmartTiming::nominal()) {
+        EcoSmartWaveform wave{data, nbits, 0, {}};
+        wave.set(data, nbits, timing);
+        return wave;
+    }
+
+    // Encode a frame into this waveform in place, as encode() does, without
+    // building and copying a whole new table. Entries past len are left as
+    // they were.
+    ECOSMART_CONSTEXPR14 void set(uint64_t data, uint16_t nbits = ECOSMART_BITS,
+                                  const EcoSmartTiming &timing = EcoSmartTiming::nominal()) {
+        this->data = data;
+        bits = nbits;
+        len = 0;
+        if (nbits == 0 || nbits > ECOSMART_MAX_BITS) {
+            return;
+        }
+
+        uint16_t n = 0;
+        durations[n++] = timing.hdrMark;
+        durations[n++] = timing.hdrSpace;
+        for (uint16_t i = nbits; i > 0; i--) {
+            durations[n++] = ((data >> (i - 1)) & 1U) ? timing.bitMarkHigh : timing.bitMarkLow;
+            durations[n++] = timing.bitSpace;
+        }
+        // wait this long between repeats (and after the last frame)
+        durations[n - 1] = timing.rptSpace;
+        len = n;
+    }
+
+    // Total time on the wire for one frame, including the trailing repeat space.
+    ECOSMART_CONSTEXPR14 uint32_t durationUs() const {
+        uint32_t total = 0;
+        for (uint16_t i = 0; i < len; i++) {
+            total += durations[i];
+        }
+        return total;
+    }
+
+    bool valid() const {
+        return len != 0;
+    }
+};
+
+
+#endif //ECOSMART_NODEMCU_ECOSMART_WAVEFORM_H
@@ -0,0 +1,150 @@
+/*
+  Host tests for the coalescing command stage: the settle window, which
+  requests skip it, and confirmation with retries.
+
+    pio test -e native
+*/
+
+#include <unity.h>
+
+#include "ecosmart_commands.h"
+
+
+static const uint32_t SETTLE_MS = 200;
+
+static const EcoSmartFrame ON_105(0x0F3C186929ULL);
+static const EcoSmartFrame OFF_105 = ON_105.withOn(false);
+
+
+// Hand the target to the transmitter as soon as it is due, from nowMs on.
+// Returns:
+//   When it was sent.
+static uint32_t sendWhenDue(EcoSmartCommander &commander, uint32_t nowMs) {
+    while (!commander.due(nowMs)) {
+        nowMs++;
+    }
+    commander.sent(nowMs);
+    return nowMs;
+}
+
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+
+void test_requests_coalesce_until_settled(void) {
+    EcoSmartCommander commander(SETTLE_MS);
+    for (uint8_t f = 100; f < 110; f++) {
+        commander.request(ON_105.withTempF(f), 1000 + f);
+        TEST_ASSERT_FALSE(commander.due(1000 + f));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1109 + SETTLE_MS, sendWhenDue(commander, 1109));
+    TEST_ASSERT_EQUAL_UINT8(109, commander.target().tempF());
+    TEST_ASSERT_EQUAL_UINT32(10, commander.received());
+    TEST_ASSERT_EQUAL_UINT32(1, commander.framesSent());
+}
+
+void test_switching_off_skips_settle(void) {
+    EcoSmartCommander commander(SETTLE_MS);
+    commander.request(ON_105, 1000);
+    sendWhenDue(commander, 1000);
+    commander.request(OFF_105, 2000);
+    TEST_ASSERT_TRUE(commander.due(2000));
+}
+
+void test_off_before_on_was_sent_skips_settle(void) {
+    EcoSmartCommander commander(SETTLE_MS);
+    commander.request(OFF_105, 1000);
+    sendWhenDue(commander, 1000);
+    commander.request(ON_105, 2000);
+    commander.request(OFF_105, 2010);
+    TEST_ASSERT_TRUE(commander.due(2010));
+}
+
+void test_first_off_skips_settle(void) {
+    // nothing sent yet, so the heater may well be on
+    EcoSmartCommander commander(SETTLE_MS);
+    commander.request(OFF_105, 1000);
+    TEST_ASSERT_TRUE(commander.due(1000));
+}
+
+void test_setpoint_while_off_settles(void) {
+    EcoSmartCommander commander(SETTLE_MS);
+    commander.request(OFF_105, 1000);
+    sendWhenDue(commander, 1000);
+    commander.request(OFF_105.withTempF(110), 2000);
+    TEST_ASSERT_FALSE(commander.due(2000));
+    commander.request(OFF_105.withTempF(111), 2050);
+    TEST_ASSERT_FALSE(commander.due(2100));
+    TEST_ASSERT_TRUE(commander.due(2050 + SETTLE_MS));
+}
+
+void test_off_pending_stays_urgent(void) {
+    EcoSmartCommander commander(SETTLE_MS);
+    commander.request(ON_105, 1000);
+    sendWhenDue(commander, 1000);
+    commander.request(OFF_105, 2000);
+    commander.request(OFF_105.withTempF(110), 2001);
+    TEST_ASSERT_TRUE(commander.due(2001));
+}
+
+void test_switching_on_settles(void) {
+    EcoSmartCommander commander(SETTLE_MS);
+    commander.request(OFF_105, 1000);
+    sendWhenDue(commander, 1000);
+    commander.request(ON_105, 2000);
+    TEST_ASSERT_FALSE(commander.due(2000));
+    TEST_ASSERT_TRUE(commander.due(2000 + SETTLE_MS));
+}
+
+void test_confirmed_first_time(void) {
+    EcoSmartCommander commander(SETTLE_MS);
+    EcoSmartDelivery outcome;
+    commander.setConfirmation(500, 2);
+    commander.request(ON_105, 1000);
+    uint32_t sentAt = sendWhenDue(commander, 1000);
+    TEST_ASSERT_TRUE(commander.awaiting());
+    commander.observe(ON_105.withTempF(100), sentAt + 100);
+    TEST_ASSERT_FALSE(commander.finished(sentAt + 100, &outcome));
+    commander.observe(ON_105.withFlow(true), sentAt + 150);
+    TEST_ASSERT_TRUE(commander.finished(sentAt + 150, &outcome));
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_ACKNOWLEDGED, outcome);
+    TEST_ASSERT_EQUAL_UINT32(150, commander.latencyMs());
+}
+
+void test_retries_double_then_fail(void) {
+    EcoSmartCommander commander(SETTLE_MS);
+    EcoSmartDelivery outcome;
+    commander.setConfirmation(500, 2);
+    commander.request(ON_105, 0);
+    uint32_t t = sendWhenDue(commander, 0);
+    TEST_ASSERT_EQUAL_UINT32(t + 500, sendWhenDue(commander, t));
+    t += 500;
+    TEST_ASSERT_EQUAL_UINT32(t + 1000, sendWhenDue(commander, t));
+    t += 1000;
+    TEST_ASSERT_FALSE(commander.due(t + 5000));
+    TEST_ASSERT_FALSE(commander.finished(t + 1999, &outcome));
+    TEST_ASSERT_TRUE(commander.finished(t + 2000, &outcome));
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_FAILED, outcome);
+    TEST_ASSERT_EQUAL_UINT8(3, commander.attempts());
+}
+
+
+int main(int argc, char **argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_requests_coalesce_until_settled);
+    RUN_TEST(test_switching_off_skips_settle);
+    RUN_TEST(test_off_before_on_was_sent_skips_settle);
+    RUN_TEST(test_first_off_skips_settle);
+    RUN_TEST(test_setpoint_while_off_settles);
+    RUN_TEST(test_off_pending_stays_urgent);
+    RUN_TEST(test_switching_on_settles);
+    RUN_TEST(test_confirmed_first_time);
+    RUN_TEST(test_retries_double_then_fail);
+    return UNITY_END();
+}
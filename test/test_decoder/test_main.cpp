@@ -0,0 +1,235 @@
+/*
+  Host tests for the streaming decoder, fed synthetic mark/space durations.
+
+    pio test -e native
+*/
+
+#include <unity.h>
+
+#include "ecosmart_decoder.h"
+#include "ecosmart_waveform.h"
+
+
+static const uint64_t FRAME = 0x0F3C186929ULL;
+
+
+// Feed every duration of one frame, including its trailing repeat space, and
+// return how many of them completed a frame.
+static uint32_t feedFrame(EcoSmartDecoder &decoder, uint64_t data) {
+    EcoSmartWaveform wave = EcoSmartWaveform::encode(data);
+    uint32_t frames = 0;
+    for (uint16_t i = 0; i < wave.len; i++) {
+        frames += decoder.feed(wave.durations[i]);
+    }
+    return frames;
+}
+
+// Feed a header and the first bits of data, count durations in all.
+static void feedPartial(EcoSmartDecoder &decoder, uint64_t data, uint16_t count) {
+    EcoSmartWaveform wave = EcoSmartWaveform::encode(data);
+    for (uint16_t i = 0; i < count && i < wave.len; i++) {
+        decoder.feed(wave.durations[i]);
+    }
+}
+
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+
+void test_frame_completes_on_last_bit_mark(void) {
+    EcoSmartDecoder decoder;
+    decoder.reset();
+    EcoSmartWaveform wave = EcoSmartWaveform::encode(FRAME);
+    // header, 40 marks and 39 spaces: the 82nd duration is the repeat space
+    TEST_ASSERT_EQUAL_UINT16(2 + 2 * ECOSMART_BITS, wave.len);
+    for (uint16_t i = 0; i + 2 < wave.len; i++) {
+        TEST_ASSERT_FALSE(decoder.feed(wave.durations[i]));
+    }
+    TEST_ASSERT_TRUE(decoder.feed(wave.durations[wave.len - 2]));
+    TEST_ASSERT_EQUAL_HEX64(FRAME, decoder.value());
+    TEST_ASSERT_EQUAL_UINT8(100, decoder.confidence());
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.attempts());
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.decoded());
+    TEST_ASSERT_EQUAL_UINT32(0, decoder.failures());
+}
+
+void test_header_widths(void) {
+    EcoSmartDecoder decoder;
+    decoder.reset();
+    TEST_ASSERT_FALSE(decoder.feed(ECOSMART_HDR_MARK / 2));
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.failures(ECOSMART_FAIL_HDR_MARK));
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_FAIL_HDR_MARK, decoder.lastFailure());
+
+    decoder.reset();
+    decoder.feed(ECOSMART_HDR_MARK);
+    TEST_ASSERT_FALSE(decoder.feed(ECOSMART_HDR_SPACE / 2));
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.failures(ECOSMART_FAIL_HDR_SPACE));
+
+    // within tolerance either side of nominal
+    decoder.reset();
+    decoder.feed(ECOSMART_HDR_MARK * 110 / 100);
+    decoder.feed(ECOSMART_HDR_SPACE * 90 / 100);
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_FAIL_REASONS, decoder.lastFailure());
+    TEST_ASSERT_EQUAL_UINT32(2, decoder.failures());
+}
+
+void test_bit_widths(void) {
+    EcoSmartDecoder decoder;
+    decoder.reset();
+    decoder.feed(ECOSMART_HDR_MARK);
+    decoder.feed(ECOSMART_HDR_SPACE);
+    decoder.feed(ECOSMART_BIT_MARK_HIGH);
+    decoder.feed(ECOSMART_BIT_SPACE);
+    TEST_ASSERT_FALSE(decoder.feed((ECOSMART_BIT_MARK_HIGH + ECOSMART_BIT_MARK_LOW) / 2));
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.failures(ECOSMART_FAIL_BIT_MARK));
+
+    decoder.reset();
+    decoder.feed(ECOSMART_HDR_MARK);
+    decoder.feed(ECOSMART_HDR_SPACE);
+    decoder.feed(ECOSMART_BIT_MARK_LOW);
+    TEST_ASSERT_FALSE(decoder.feed(ECOSMART_BIT_SPACE * 2));
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.failures(ECOSMART_FAIL_BIT_SPACE));
+}
+
+void test_ones_and_zeros(void) {
+    const uint64_t patterns[] = {0, 0xFFFFFFFFFFULL, 0xAAAAAAAAAAULL, 0x5555555555ULL, 0x8000000001ULL};
+    for (uint64_t data : patterns) {
+        EcoSmartDecoder decoder;
+        decoder.reset();
+        TEST_ASSERT_EQUAL_UINT32(1, feedFrame(decoder, data));
+        TEST_ASSERT_EQUAL_HEX64(data, decoder.value());
+    }
+}
+
+void test_repeats_decode_back_to_back(void) {
+    EcoSmartDecoder decoder;
+    decoder.reset();
+    TEST_ASSERT_EQUAL_UINT32(3, feedFrame(decoder, FRAME) + feedFrame(decoder, FRAME) + feedFrame(decoder, FRAME));
+    TEST_ASSERT_EQUAL_UINT32(3, decoder.attempts());
+    TEST_ASSERT_EQUAL_UINT32(0, decoder.failures());
+}
+
+void test_repeat_followed_by_other_mark(void) {
+    EcoSmartDecoder decoder;
+    decoder.reset();
+    feedFrame(decoder, FRAME);
+    TEST_ASSERT_FALSE(decoder.feed(ECOSMART_BIT_MARK_HIGH));
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.failures(ECOSMART_FAIL_REPEAT));
+}
+
+void test_repeat_space_width(void) {
+    EcoSmartDecoder decoder;
+    decoder.reset();
+    feedPartial(decoder, FRAME, 2 * ECOSMART_BITS + 1);
+    TEST_ASSERT_FALSE(decoder.feed(ECOSMART_RPT_SPACE * 2));
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.failures(ECOSMART_FAIL_REPEAT));
+
+    decoder.reset();
+    feedPartial(decoder, FRAME, 2 * ECOSMART_BITS + 1);
+    TEST_ASSERT_FALSE(decoder.feed(ECOSMART_RPT_SPACE / 2));
+    TEST_ASSERT_EQUAL_UINT32(2, decoder.failures(ECOSMART_FAIL_REPEAT));
+    TEST_ASSERT_EQUAL_UINT32(2, decoder.decoded());
+}
+
+void test_resync_after_noise(void) {
+    static const uint32_t noise[] = {130, 2210, 980, 55, 4400, 610, 12000, 300, 1500};
+    EcoSmartDecoder decoder;
+    decoder.reset();
+    for (uint32_t us : noise) {
+        TEST_ASSERT_FALSE(decoder.feed(us));
+    }
+    TEST_ASSERT_TRUE(decoder.failures() > 0);
+
+    // the next header mark starts a frame again, whatever came before
+    TEST_ASSERT_EQUAL_UINT32(1, feedFrame(decoder, FRAME));
+    TEST_ASSERT_EQUAL_HEX64(FRAME, decoder.value());
+
+    // ...including part way through a frame
+    feedPartial(decoder, FRAME, 30);
+    decoder.feed((ECOSMART_BIT_MARK_HIGH + ECOSMART_BIT_MARK_LOW) / 2);
+    TEST_ASSERT_EQUAL_UINT32(1, feedFrame(decoder, ~FRAME & 0xFFFFFFFFFFULL));
+    TEST_ASSERT_EQUAL_HEX64(~FRAME & 0xFFFFFFFFFFULL, decoder.value());
+}
+
+// Through the receiver: a gap abandons a partial frame without counting a
+// failure, and the next burst decodes.
+void test_gap_resets_receiver(void) {
+    EcoSmartReceiver receiver;
+    EcoSmartWaveform wave = EcoSmartWaveform::encode(FRAME);
+    uint32_t now = 1000000;
+    receiver.edge(now);
+
+    for (uint16_t i = 0; i < 30; i++) {
+        now += wave.durations[i];
+        receiver.edge(now);
+    }
+    now += ECOSMART_GAP_US + 1000;
+    receiver.edge(now);
+    TEST_ASSERT_EQUAL_UINT32(0, receiver.decoder().failures());
+
+    for (uint16_t i = 0; i + 1 < wave.len; i++) {
+        now += wave.durations[i];
+        receiver.edge(now);
+    }
+    EcoSmartFrameRecord record;
+    TEST_ASSERT_TRUE(receiver.read(&record));
+    TEST_ASSERT_EQUAL_HEX64(FRAME, record.frame);
+    TEST_ASSERT_EQUAL_UINT32(now, record.micros);
+    TEST_ASSERT_FALSE(receiver.read(&record));
+    TEST_ASSERT_EQUAL_UINT32(0, receiver.decoder().failures());
+}
+
+void test_voting_outvotes_a_bad_repeat(void) {
+    EcoSmartDecoder decoder;
+    decoder.setVoting(true);
+    decoder.reset();
+    feedFrame(decoder, FRAME);
+    feedFrame(decoder, FRAME ^ 0x10);       // one corrupted repeat
+    feedFrame(decoder, FRAME);
+    TEST_ASSERT_EQUAL_HEX64(FRAME, decoder.value());
+    TEST_ASSERT_TRUE(decoder.confidence() < 100);
+}
+
+void test_voting_confidence_needs_a_second_repeat(void) {
+    EcoSmartDecoder decoder;
+    decoder.setVoting(true);
+    decoder.reset();
+    TEST_ASSERT_EQUAL_UINT32(1, feedFrame(decoder, FRAME));
+    TEST_ASSERT_EQUAL_HEX64(FRAME, decoder.value());
+    TEST_ASSERT_EQUAL_UINT8(50, decoder.confidence());
+    TEST_ASSERT_EQUAL_UINT32(1, feedFrame(decoder, FRAME));
+    TEST_ASSERT_EQUAL_UINT8(100, decoder.confidence());
+}
+
+void test_failure_names(void) {
+    TEST_ASSERT_EQUAL_STRING("hdr_mark", ecoSmartFailureName(ECOSMART_FAIL_HDR_MARK));
+    TEST_ASSERT_EQUAL_STRING("hdr_space", ecoSmartFailureName(ECOSMART_FAIL_HDR_SPACE));
+    TEST_ASSERT_EQUAL_STRING("bit_mark", ecoSmartFailureName(ECOSMART_FAIL_BIT_MARK));
+    TEST_ASSERT_EQUAL_STRING("bit_space", ecoSmartFailureName(ECOSMART_FAIL_BIT_SPACE));
+    TEST_ASSERT_EQUAL_STRING("repeat", ecoSmartFailureName(ECOSMART_FAIL_REPEAT));
+    TEST_ASSERT_EQUAL_STRING("unknown", ecoSmartFailureName(ECOSMART_FAIL_REASONS));
+}
+
+
+int main(int argc, char **argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_completes_on_last_bit_mark);
+    RUN_TEST(test_header_widths);
+    RUN_TEST(test_bit_widths);
+    RUN_TEST(test_ones_and_zeros);
+    RUN_TEST(test_repeats_decode_back_to_back);
+    RUN_TEST(test_repeat_followed_by_other_mark);
+    RUN_TEST(test_repeat_space_width);
+    RUN_TEST(test_resync_after_noise);
+    RUN_TEST(test_gap_resets_receiver);
+    RUN_TEST(test_voting_outvotes_a_bad_repeat);
+    RUN_TEST(test_voting_confidence_needs_a_second_repeat);
+    RUN_TEST(test_failure_names);
+    return UNITY_END();
+}
@@ -0,0 +1,143 @@
+/*
+  Host tests for the offline frame journal: a simulated day of heater traffic
+  must replay exactly, and a full journal must keep the newest history.
+
+    pio test -e native
+*/
+
+#include <string.h>
+#include <unity.h>
+#include <vector>
+
+#include "ecosmart_frame.h"
+#include "ecosmart_journal.h"
+
+
+static const uint32_t DAY_MS = 24UL * 60 * 60 * 1000;
+
+
+// One frame a second for durationMs: a draw every half hour or so, of 30 s to
+// 10 min, and a setpoint change about twice a day. Every change is appended
+// to journal and, if it was stored, to changes. Returns the frames seen.
+template<uint16_t N>
+static uint32_t simulate(EcoSmartJournal<N> &journal, uint32_t durationMs, uint32_t seed,
+                         std::vector<EcoSmartJournalEntry> &changes) {
+    EcoSmartFrame frame(0x0F3C186929ULL);
+    uint32_t drawEnd = 0;
+    uint32_t frames = 0;
+    for (uint32_t now = 0; now < durationMs; now += 1000, frames++) {
+        seed = seed * 1103515245U + 12345U;
+        uint32_t r = seed >> 8;
+        if (!frame.flow() && r % 1800 == 0) {
+            frame.setFlow(true);
+            drawEnd = now + 30000 + r % 600000;
+        } else if (frame.flow() && now >= drawEnd) {
+            frame.setFlow(false);
+        }
+        if (r % 43200 == 1) {
+            uint8_t c = static_cast<uint8_t>(38 + r % 12);
+            frame.setTempC(c);
+            frame.setTempF(static_cast<uint8_t>(c * 9 / 5 + 32));
+        }
+        if (journal.append(frame.raw(), now)) {
+            changes.push_back({frame.raw(), now});
+        }
+    }
+    return frames;
+}
+
+// Pop every record and count those that differ from expected[first...].
+template<uint16_t N>
+static uint32_t mismatches(EcoSmartJournal<N> &journal, const std::vector<EcoSmartJournalEntry> &expected,
+                           size_t first) {
+    uint32_t bad = 0;
+    size_t i = first;
+    EcoSmartJournalEntry entry;
+    for (; journal.peek(&entry); i++, journal.pop()) {
+        if (i >= expected.size() || entry.frame != expected[i].frame || entry.millis != expected[i].millis) {
+            bad++;
+        }
+    }
+    return bad + static_cast<uint32_t>(expected.size() - (i < expected.size() ? i : expected.size()));
+}
+
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+
+void test_day_of_traffic_replays_exactly(void) {
+    static EcoSmartJournal<2048> journal;     // JOURNAL_BYTES in ecosmart_remote.cpp
+    journal = EcoSmartJournal<2048>();
+    std::vector<EcoSmartJournalEntry> changes;
+    uint32_t frames = simulate(journal, DAY_MS, 1, changes);
+    TEST_ASSERT_EQUAL_UINT32(DAY_MS / 1000, frames);
+    TEST_ASSERT_TRUE(changes.size() > 40);
+    TEST_ASSERT_EQUAL_UINT32(changes.size(), journal.records());
+    TEST_ASSERT_EQUAL_UINT32(0, journal.dropped());
+    TEST_ASSERT_EQUAL_UINT32(0, mismatches(journal, changes, 0));
+    TEST_ASSERT_TRUE(journal.empty());
+}
+
+void test_repeats_are_not_stored(void) {
+    EcoSmartJournal<64> journal;
+    TEST_ASSERT_TRUE(journal.append(0x0F3C186929ULL, 0));
+    TEST_ASSERT_FALSE(journal.append(0x0F3C186929ULL, 1000));
+    TEST_ASSERT_TRUE(journal.append(0x0F3C1C6929ULL, 2000));
+    TEST_ASSERT_EQUAL_UINT16(2, journal.records());
+}
+
+void test_flow_change_costs_five_bytes(void) {
+    EcoSmartJournal<64> journal;
+    journal.append(0x0F3C186929ULL, 0);
+    uint16_t before = journal.used();
+    journal.append(EcoSmartFrame(0x0F3C186929ULL).withFlow(true).raw(), 5UL * 60 * 1000);
+    TEST_ASSERT_EQUAL_UINT16(5, journal.used() - before);
+}
+
+void test_full_journal_keeps_newest(void) {
+    static EcoSmartJournal<256> journal;
+    journal = EcoSmartJournal<256>();
+    std::vector<EcoSmartJournalEntry> changes;
+    simulate(journal, DAY_MS, 7, changes);
+    TEST_ASSERT_TRUE(journal.dropped() > 0);
+    TEST_ASSERT_EQUAL_UINT32(changes.size(), journal.records() + journal.dropped());
+    TEST_ASSERT_TRUE(journal.used() <= journal.capacity());
+    TEST_ASSERT_EQUAL_UINT32(0, mismatches(journal, changes, journal.dropped()));
+}
+
+void test_copied_journal_rebases(void) {
+    EcoSmartJournal<128> journal;
+    journal.append(0x0F3C186929ULL, 1000);
+    journal.append(0x0F3C1C6929ULL, 61000);
+
+    // as saved to and restored from flash
+    EcoSmartJournal<128> restored;
+    memcpy(static_cast<void *>(&restored), &journal, sizeof(journal));
+    restored.rebase(500);
+
+    EcoSmartJournalEntry entry;
+    TEST_ASSERT_TRUE(restored.peek(&entry));
+    TEST_ASSERT_EQUAL_HEX64(0x0F3C186929ULL, entry.frame);
+    TEST_ASSERT_EQUAL_UINT32(500U - 60000U, entry.millis);     // wrapped, as millis() would
+    restored.pop();
+    TEST_ASSERT_TRUE(restored.peek(&entry));
+    TEST_ASSERT_EQUAL_HEX64(0x0F3C1C6929ULL, entry.frame);
+    TEST_ASSERT_EQUAL_UINT32(500, entry.millis);
+}
+
+
+int main(int argc, char **argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_day_of_traffic_replays_exactly);
+    RUN_TEST(test_repeats_are_not_stored);
+    RUN_TEST(test_flow_change_costs_five_bytes);
+    RUN_TEST(test_full_journal_keeps_newest);
+    RUN_TEST(test_copied_journal_rebases);
+    return UNITY_END();
+}
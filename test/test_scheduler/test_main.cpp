@@ -0,0 +1,211 @@
+/*
+  Host tests for channels and the transmit scheduler: commands build on what
+  was requested rather than on stale heater reports, and wait for a quiet
+  line, but no longer than the maximum deferral, which starts afresh for
+  every command.
+
+    pio test -e native
+*/
+
+#include <unity.h>
+
+#include "ecosmart_channel.h"
+
+
+static const uint32_t SETTLE_MS = 200;
+static const uint32_t MAX_DEFER_MS = 1000;
+static const EcoSmartFrame ON_105(0x0F3C186929ULL);
+
+
+// Make the heater on channel look mid-burst right now.
+static void talk(EcoSmartChannel &channel) {
+    uint32_t now = micros();
+    channel.receiver().edge(now - 2 * ECOSMART_LINE_IDLE_US);
+    channel.receiver().edge(now);
+}
+
+// Play the transmission in progress to the end and dispatch its callback.
+static void finishTransmission(EcoSmartScheduler &scheduler) {
+    uint8_t level;
+    uint32_t us;
+    while (EcoSmartMockTimer::instance().step(&level, &us)) {
+    }
+    scheduler.transmitter().loop();
+}
+
+static void request(EcoSmartChannel &channel, const EcoSmartFrame &frame, uint32_t nowMs) {
+    channel.command() = frame;
+    channel.request(nowMs);
+}
+
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+
+void test_reports_follow_when_idle(void) {
+    EcoSmartChannel channel(4, 12, SETTLE_MS, 1);
+    channel.observe(ON_105.withFlow(true), 0);
+    TEST_ASSERT_EQUAL_HEX64(ON_105.withFlow(true).raw(), channel.command().raw());
+    TEST_ASSERT_EQUAL_HEX64(ON_105.withFlow(true).raw(), channel.reported().raw());
+}
+
+// Heat is requested, the heater reports off again before taking it, then a
+// setpoint arrives: the new target must still be heat, and must not go out
+// at once as a switch-off.
+void test_stale_report_keeps_pending_edits(void) {
+    const EcoSmartFrame off = ON_105.withOn(false);
+    EcoSmartChannel channel(4, 12, SETTLE_MS, 1);
+    channel.observe(off, 0);
+
+    channel.command().setOn(true);
+    channel.request(1000);
+    channel.observe(off, 1050);
+    TEST_ASSERT_TRUE(channel.command().on());
+    TEST_ASSERT_EQUAL_HEX64(off.raw(), channel.reported().raw());
+    channel.command().setTempF(110);
+    channel.request(1100);
+
+    EcoSmartCommander &commander = channel.commander();
+    TEST_ASSERT_TRUE(commander.target().on());
+    TEST_ASSERT_EQUAL_UINT8(110, commander.target().tempF());
+    TEST_ASSERT_FALSE(commander.due(1100));
+    TEST_ASSERT_TRUE(commander.due(1100 + SETTLE_MS));
+}
+
+void test_stale_report_keeps_unconfirmed_edits(void) {
+    const EcoSmartFrame off = ON_105.withOn(false);
+    EcoSmartChannel channel(4, 12, SETTLE_MS, 1);
+    EcoSmartCommander &commander = channel.commander();
+    commander.setConfirmation(2000, 1);
+    channel.observe(off, 0);
+
+    channel.command().setOn(true);
+    channel.request(1000);
+    commander.sent(1000 + SETTLE_MS);
+    channel.observe(off, 1500);
+    TEST_ASSERT_TRUE(commander.awaiting());
+    channel.command().setTempF(110);
+    channel.request(1600);
+    TEST_ASSERT_TRUE(commander.target().on());
+    TEST_ASSERT_EQUAL_UINT8(110, commander.target().tempF());
+
+    // once confirmed, the command follows the heater again
+    commander.sent(1600 + SETTLE_MS);
+    channel.observe(ON_105.withTempF(110), 2000);
+    TEST_ASSERT_FALSE(commander.awaiting());
+    channel.observe(ON_105.withTempF(110).withFlow(true), 3000);
+    TEST_ASSERT_TRUE(channel.command().flow());
+}
+
+void test_quiet_line_sends_when_due(void) {
+    EcoSmartChannel channel(4, 12, SETTLE_MS, 1);
+    EcoSmartScheduler scheduler;
+    scheduler.add(&channel);
+    request(channel, ON_105, 1000);
+    TEST_ASSERT_NULL(scheduler.loop(1000 + SETTLE_MS - 1));
+    TEST_ASSERT_EQUAL_PTR(&channel, scheduler.loop(1000 + SETTLE_MS));
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler.deferredMs());
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler.forced());
+    finishTransmission(scheduler);
+}
+
+void test_talking_line_defers_up_to_max(void) {
+    EcoSmartChannel channel(4, 12, SETTLE_MS, 1);
+    EcoSmartScheduler scheduler;
+    scheduler.setMaxDefer(MAX_DEFER_MS);
+    scheduler.add(&channel);
+    request(channel, ON_105, 0);
+    for (uint32_t t = SETTLE_MS; t < SETTLE_MS + MAX_DEFER_MS; t += 10) {
+        talk(channel);
+        TEST_ASSERT_NULL(scheduler.loop(t));
+    }
+    talk(channel);
+    TEST_ASSERT_EQUAL_PTR(&channel, scheduler.loop(SETTLE_MS + MAX_DEFER_MS));
+    TEST_ASSERT_EQUAL_UINT32(MAX_DEFER_MS, scheduler.deferredMs());
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler.forced());
+    finishTransmission(scheduler);
+}
+
+void test_superseding_command_defers_afresh(void) {
+    EcoSmartChannel channel(4, 12, SETTLE_MS, 1);
+    EcoSmartScheduler scheduler;
+    scheduler.setMaxDefer(MAX_DEFER_MS);
+    scheduler.add(&channel);
+
+    // held from 200 ms, then superseded; due again from 1100 ms
+    request(channel, ON_105, 0);
+    for (uint32_t t = SETTLE_MS; t < 900; t += 10) {
+        talk(channel);
+        TEST_ASSERT_NULL(scheduler.loop(t));
+    }
+    request(channel, ON_105.withTempF(110), 900);
+    for (uint32_t t = 900; t < 1100 + MAX_DEFER_MS; t += 10) {
+        talk(channel);
+        TEST_ASSERT_NULL(scheduler.loop(t));
+    }
+    talk(channel);
+    TEST_ASSERT_EQUAL_PTR(&channel, scheduler.loop(1100 + MAX_DEFER_MS));
+    TEST_ASSERT_EQUAL_UINT32(MAX_DEFER_MS, scheduler.deferredMs());
+    TEST_ASSERT_EQUAL_UINT8(110, channel.commander().target().tempF());
+    finishTransmission(scheduler);
+}
+
+void test_urgent_supersede_defers_afresh(void) {
+    EcoSmartChannel channel(4, 12, SETTLE_MS, 1);
+    EcoSmartScheduler scheduler;
+    scheduler.setMaxDefer(MAX_DEFER_MS);
+    scheduler.add(&channel);
+
+    // an off command held for 600 ms, then another off command
+    request(channel, ON_105.withOn(false), 0);
+    for (uint32_t t = 0; t < 600; t += 10) {
+        talk(channel);
+        TEST_ASSERT_NULL(scheduler.loop(t));
+    }
+    request(channel, ON_105.withOn(false).withTempF(110), 600);
+    for (uint32_t t = 600; t < 600 + MAX_DEFER_MS; t += 10) {
+        talk(channel);
+        TEST_ASSERT_NULL(scheduler.loop(t));
+    }
+    talk(channel);
+    TEST_ASSERT_EQUAL_PTR(&channel, scheduler.loop(600 + MAX_DEFER_MS));
+    finishTransmission(scheduler);
+}
+
+void test_channels_take_turns(void) {
+    EcoSmartChannel upstairs(4, 12, SETTLE_MS, 1);
+    EcoSmartChannel downstairs(5, 14, SETTLE_MS, 1);
+    EcoSmartScheduler scheduler;
+    scheduler.add(&upstairs);
+    scheduler.add(&downstairs);
+    request(upstairs, ON_105, 0);
+    request(downstairs, ON_105, 0);
+
+    EcoSmartChannel *first = scheduler.loop(SETTLE_MS);
+    TEST_ASSERT_EQUAL_PTR(&upstairs, first);
+    TEST_ASSERT_NULL(scheduler.loop(SETTLE_MS));     // the transmitter is busy
+    finishTransmission(scheduler);
+    TEST_ASSERT_EQUAL_PTR(&downstairs, scheduler.loop(SETTLE_MS + 200));
+    TEST_ASSERT_EQUAL_PTR(&downstairs, scheduler.current());
+    finishTransmission(scheduler);
+}
+
+
+int main(int argc, char **argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_reports_follow_when_idle);
+    RUN_TEST(test_stale_report_keeps_pending_edits);
+    RUN_TEST(test_stale_report_keeps_unconfirmed_edits);
+    RUN_TEST(test_quiet_line_sends_when_due);
+    RUN_TEST(test_talking_line_defers_up_to_max);
+    RUN_TEST(test_superseding_command_defers_afresh);
+    RUN_TEST(test_urgent_supersede_defers_afresh);
+    RUN_TEST(test_channels_take_turns);
+    return UNITY_END();
+}
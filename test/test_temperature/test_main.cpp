@@ -0,0 +1,131 @@
+/*
+  Host tests for temperature commands: parsing payloads in tenths and turning
+  them into setpoint pairs, rounded once to the nearest whole degree.
+
+    pio test -e native
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "ecosmart_dispatch.h"
+#include "ecosmart_temperature.h"
+
+
+static bool parse(const char *text, int32_t *tenths) {
+    return ecoSmartParseTenths(reinterpret_cast<const uint8_t *>(text), static_cast<unsigned int>(strlen(text)),
+                               -9999, 9999, tenths);
+}
+
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+
+void test_parse_tenths(void) {
+    int32_t tenths;
+    TEST_ASSERT_TRUE(parse("41", &tenths));
+    TEST_ASSERT_EQUAL_INT32(410, tenths);
+    TEST_ASSERT_TRUE(parse("41.5", &tenths));
+    TEST_ASSERT_EQUAL_INT32(415, tenths);
+    TEST_ASSERT_TRUE(parse("-3", &tenths));
+    TEST_ASSERT_EQUAL_INT32(-30, tenths);
+    TEST_ASSERT_TRUE(parse("+105.", &tenths));
+    TEST_ASSERT_EQUAL_INT32(1050, tenths);
+}
+
+void test_parse_drops_further_digits(void) {
+    int32_t tenths;
+    TEST_ASSERT_TRUE(parse("41.45", &tenths));
+    TEST_ASSERT_EQUAL_INT32(414, tenths);
+    TEST_ASSERT_TRUE(parse("105.99", &tenths));
+    TEST_ASSERT_EQUAL_INT32(1059, tenths);
+    TEST_ASSERT_TRUE(parse("-3.45", &tenths));
+    TEST_ASSERT_EQUAL_INT32(-34, tenths);
+}
+
+void test_parse_rejects(void) {
+    int32_t tenths;
+    TEST_ASSERT_FALSE(parse("", &tenths));
+    TEST_ASSERT_FALSE(parse("-", &tenths));
+    TEST_ASSERT_FALSE(parse(".5", &tenths));
+    TEST_ASSERT_FALSE(parse("41C", &tenths));
+    TEST_ASSERT_FALSE(parse("41.5.", &tenths));
+    TEST_ASSERT_FALSE(parse("1000", &tenths));
+    TEST_ASSERT_FALSE(parse("-1000", &tenths));
+}
+
+// Every payload with up to two decimals gives the setpoint strtof() and
+// roundf() would give for its whole degree.
+void test_rounds_once_like_roundf(void) {
+    for (int32_t hundredths = 2000; hundredths <= 16000; hundredths++) {
+        char text[16];
+        snprintf(text, sizeof(text), "%d.%02d", hundredths / 100, hundredths % 100);
+        int32_t tenths;
+        TEST_ASSERT_TRUE(parse(text, &tenths));
+        int32_t expected = static_cast<int32_t>(roundf(strtof(text, nullptr)));
+        TEST_ASSERT_EQUAL_INT32(expected, ecoSmartRoundTenths(tenths));
+    }
+}
+
+void test_setpoint_pairs(void) {
+    EcoSmartSetpoint setpoint = ecoSmartSetpointC(414);
+    TEST_ASSERT_EQUAL_UINT8(41, setpoint.c);
+    TEST_ASSERT_EQUAL_UINT8(106, setpoint.f);
+    setpoint = ecoSmartSetpointC(415);
+    TEST_ASSERT_EQUAL_UINT8(42, setpoint.c);
+    setpoint = ecoSmartSetpointF(1055);
+    TEST_ASSERT_EQUAL_UINT8(106, setpoint.f);
+    TEST_ASSERT_EQUAL_UINT8(41, setpoint.c);
+}
+
+// Fractional commands are rounded in their own scale before pairing, so they
+// can differ from converting the fraction first (26.5C used to be 80F/27C).
+static void assertPair(const char *text, bool use_c, uint8_t f, uint8_t c) {
+    int32_t tenths;
+    TEST_ASSERT_TRUE(parse(text, &tenths));
+    EcoSmartSetpoint setpoint = use_c ? ecoSmartSetpointC(tenths) : ecoSmartSetpointF(tenths);
+    TEST_ASSERT_EQUAL_UINT8(f, setpoint.f);
+    TEST_ASSERT_EQUAL_UINT8(c, setpoint.c);
+}
+
+void test_fractional_payload_pairs(void) {
+    assertPair("26.5", true, 81, 27);
+    assertPair("26.4", true, 80, 27);
+    assertPair("41.45", true, 106, 41);
+    assertPair("59.6", true, 140, 60);
+    assertPair("83.3", false, 83, 28);
+    assertPair("79.5", false, 80, 27);
+    assertPair("105.55", false, 106, 41);
+    assertPair("139.6", false, 140, 60);
+}
+
+void test_setpoints_clamp(void) {
+    EcoSmartSetpoint setpoint = ecoSmartSetpointC(100);
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_TEMP_F_MIN, setpoint.f);
+    TEST_ASSERT_EQUAL_UINT8(27, setpoint.c);
+    setpoint = ecoSmartSetpointF(2000);
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_TEMP_F_MAX, setpoint.f);
+    TEST_ASSERT_EQUAL_UINT8(60, setpoint.c);
+}
+
+
+int main(int argc, char **argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_tenths);
+    RUN_TEST(test_parse_drops_further_digits);
+    RUN_TEST(test_parse_rejects);
+    RUN_TEST(test_rounds_once_like_roundf);
+    RUN_TEST(test_setpoint_pairs);
+    RUN_TEST(test_fractional_payload_pairs);
+    RUN_TEST(test_setpoints_clamp);
+    return UNITY_END();
+}
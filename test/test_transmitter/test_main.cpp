@@ -0,0 +1,147 @@
+/*
+  Host tests for the timer driven transmitter: the waveform it plays through
+  EcoSmartMockTimer is checked, interval by interval, against the protocol
+  table in the README.
+
+    pio test -e native
+*/
+
+#include <unity.h>
+
+#include "ecosmart_tx.h"
+
+
+// The README's protocol table, in us.
+static const uint32_t README_HDR_MARK = 7000;
+static const uint32_t README_HDR_SPACE = 4000;
+static const uint32_t README_BIT_MARK_1 = 2400;
+static const uint32_t README_BIT_MARK_0 = 720;
+static const uint32_t README_BIT_SPACE = 840;
+static const uint32_t README_RPT_SPACE = 2700;
+
+static const uint8_t PIN = 12;
+static const uint64_t FRAME = 0x0F3C186A29ULL;
+
+
+struct Interval {
+    uint8_t level;
+    uint32_t us;
+};
+
+// Run the mock timer until the transmission stops.
+static uint32_t play(Interval *out, uint32_t max) {
+    uint32_t n = 0;
+    Interval interval;
+    while (n < max && EcoSmartMockTimer::instance().step(&interval.level, &interval.us)) {
+        out[n++] = interval;
+    }
+    return n;
+}
+
+// Check one frame's 82 intervals starting at out[0], as the README lists
+// them: header, a mark and space per bit, the 40th space being the repeat
+// space.
+static void checkFrame(const Interval *out, uint64_t data) {
+    TEST_ASSERT_EQUAL_UINT8(HIGH, out[0].level);
+    TEST_ASSERT_EQUAL_UINT32(README_HDR_MARK, out[0].us);
+    TEST_ASSERT_EQUAL_UINT8(LOW, out[1].level);
+    TEST_ASSERT_EQUAL_UINT32(README_HDR_SPACE, out[1].us);
+    for (uint8_t bit = 0; bit < ECOSMART_BITS; bit++) {
+        const Interval &mark = out[2 + 2 * bit];
+        const Interval &space = out[3 + 2 * bit];
+        bool one = (data >> (ECOSMART_BITS - 1 - bit)) & 1U;
+        TEST_ASSERT_EQUAL_UINT8(HIGH, mark.level);
+        TEST_ASSERT_EQUAL_UINT32(one ? README_BIT_MARK_1 : README_BIT_MARK_0, mark.us);
+        TEST_ASSERT_EQUAL_UINT8(LOW, space.level);
+        TEST_ASSERT_EQUAL_UINT32(bit + 1 < ECOSMART_BITS ? README_BIT_SPACE : README_RPT_SPACE, space.us);
+    }
+}
+
+
+static EcoSmartTransmitter tx;
+
+void setUp(void) {
+    tx = EcoSmartTransmitter();
+    tx.begin(PIN);
+}
+
+void tearDown(void) {
+}
+
+
+void test_single_frame_matches_readme(void) {
+    Interval out[200];
+    TEST_ASSERT_TRUE(tx.send(FRAME, ECOSMART_BITS, 0));
+    TEST_ASSERT_TRUE(tx.busy());
+    uint32_t n = play(out, 200);
+    TEST_ASSERT_EQUAL_UINT32(82, n);
+    checkFrame(out, FRAME);
+
+    TEST_ASSERT_FALSE(tx.busy());
+    TEST_ASSERT_TRUE(tx.done());
+    TEST_ASSERT_EQUAL_UINT8(LOW, digitalRead(PIN));
+}
+
+void test_repeats_each_end_in_repeat_space(void) {
+    Interval out[400];
+    TEST_ASSERT_TRUE(tx.send(FRAME, ECOSMART_BITS, 2));
+    uint32_t n = play(out, 400);
+    TEST_ASSERT_EQUAL_UINT32(3 * 82, n);
+    for (uint32_t frame = 0; frame < 3; frame++) {
+        checkFrame(out + 82 * frame, FRAME);
+    }
+    TEST_ASSERT_EQUAL_UINT8(LOW, digitalRead(PIN));
+}
+
+void test_busy_refuses_second_send(void) {
+    Interval out[200];
+    TEST_ASSERT_TRUE(tx.send(FRAME, ECOSMART_BITS, 0));
+    TEST_ASSERT_FALSE(tx.send(FRAME ^ 1, ECOSMART_BITS, 0));
+    TEST_ASSERT_FALSE(tx.setPin(PIN + 1));
+    play(out, 200);
+    checkFrame(out, FRAME);
+}
+
+static uint64_t completed;
+
+static void onDone(uint64_t data, void *arg) {
+    (void) arg;
+    completed = data;
+}
+
+void test_callback_from_loop(void) {
+    Interval out[200];
+    completed = 0;
+    tx.onDone(onDone);
+    tx.send(FRAME, ECOSMART_BITS, 0);
+    play(out, 200);
+    TEST_ASSERT_EQUAL_HEX64(0, completed);
+    tx.loop();
+    TEST_ASSERT_EQUAL_HEX64(FRAME, completed);
+}
+
+void test_learned_timing(void) {
+    Interval out[200];
+    EcoSmartTiming timing = {7100, 3950, 2450, 700, 860, 2750};
+    tx.setTiming(timing);
+    tx.send(FRAME, ECOSMART_BITS, 0);
+    TEST_ASSERT_EQUAL_UINT32(82, play(out, 200));
+    TEST_ASSERT_EQUAL_UINT32(7100, out[0].us);
+    TEST_ASSERT_EQUAL_UINT32(3950, out[1].us);
+    TEST_ASSERT_EQUAL_UINT32(700, out[2].us);      // the frame starts with a 0 bit
+    TEST_ASSERT_EQUAL_UINT32(860, out[3].us);
+    TEST_ASSERT_EQUAL_UINT32(2750, out[81].us);
+}
+
+
+int main(int argc, char **argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_single_frame_matches_readme);
+    RUN_TEST(test_repeats_each_end_in_repeat_space);
+    RUN_TEST(test_busy_refuses_second_send);
+    RUN_TEST(test_callback_from_loop);
+    RUN_TEST(test_learned_timing);
+    return UNITY_END();
+}
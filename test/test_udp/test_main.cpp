@@ -0,0 +1,98 @@
+/*
+  Host tests for the UDP command format: requests and replies round-trip
+  byte for byte, and anything malformed is refused.
+
+    pio test -e native
+*/
+
+#include <string.h>
+#include <unity.h>
+
+#include "ecosmart_udp.h"
+
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+
+void test_request_layout(void) {
+    uint8_t out[ECOSMART_UDP_REQUEST_BYTES];
+    ecoSmartUdpEncodeRequest({ECOSMART_UDP_SET_TEMPERATURE, 0x1234, -415}, out);
+    const uint8_t expected[ECOSMART_UDP_REQUEST_BYTES] = {'E', 'S', ECOSMART_UDP_VERSION, 2, 0x12, 0x34, 0xFE, 0x61};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out, ECOSMART_UDP_REQUEST_BYTES);
+}
+
+void test_request_round_trip(void) {
+    const int16_t values[] = {0, 1, 415, -415, 9999, -9999, 32767, -32768};
+    for (int16_t value : values) {
+        uint8_t out[ECOSMART_UDP_REQUEST_BYTES];
+        ecoSmartUdpEncodeRequest({ECOSMART_UDP_SET_TEMPERATURE, 0xBEEF, value}, out);
+        EcoSmartUdpRequest request;
+        TEST_ASSERT_TRUE(ecoSmartUdpDecodeRequest(out, sizeof(out), &request));
+        TEST_ASSERT_EQUAL_UINT8(ECOSMART_UDP_SET_TEMPERATURE, request.type);
+        TEST_ASSERT_EQUAL_UINT16(0xBEEF, request.sequence);
+        TEST_ASSERT_EQUAL_INT16(value, request.value);
+    }
+}
+
+void test_reply_round_trip(void) {
+    const EcoSmartFrame frame(0x0F3C186929ULL);
+    uint8_t out[ECOSMART_UDP_REPLY_BYTES];
+    ecoSmartUdpEncodeReply({ECOSMART_UDP_QUERY, 7, ECOSMART_UDP_REJECTED, frame}, out);
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_UDP_QUERY | ECOSMART_UDP_REPLY, out[3]);
+    TEST_ASSERT_EQUAL_UINT8(0x0F, out[7]);
+    TEST_ASSERT_EQUAL_UINT8(0x29, out[11]);
+
+    EcoSmartUdpReply reply;
+    TEST_ASSERT_TRUE(ecoSmartUdpDecodeReply(out, sizeof(out), &reply));
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_UDP_QUERY, reply.type);
+    TEST_ASSERT_EQUAL_UINT16(7, reply.sequence);
+    TEST_ASSERT_EQUAL_UINT8(ECOSMART_UDP_REJECTED, reply.status);
+    TEST_ASSERT_EQUAL_HEX64(frame.raw(), reply.frame.raw());
+}
+
+void test_malformed_requests_refused(void) {
+    uint8_t good[ECOSMART_UDP_REQUEST_BYTES + 1];
+    ecoSmartUdpEncodeRequest({ECOSMART_UDP_QUERY, 1, 0}, good);
+    EcoSmartUdpRequest request;
+    TEST_ASSERT_FALSE(ecoSmartUdpDecodeRequest(good, ECOSMART_UDP_REQUEST_BYTES - 1, &request));
+    TEST_ASSERT_FALSE(ecoSmartUdpDecodeRequest(good, ECOSMART_UDP_REQUEST_BYTES + 1, &request));
+
+    for (uint8_t i = 0; i < 3; i++) {
+        uint8_t bad[ECOSMART_UDP_REQUEST_BYTES];
+        memcpy(bad, good, sizeof(bad));
+        bad[i] ^= 0x01;     // magic or version
+        TEST_ASSERT_FALSE(ecoSmartUdpDecodeRequest(bad, sizeof(bad), &request));
+    }
+
+    // a reply sent back at the remote is not a request
+    uint8_t reply[ECOSMART_UDP_REQUEST_BYTES];
+    memcpy(reply, good, sizeof(reply));
+    reply[3] |= ECOSMART_UDP_REPLY;
+    TEST_ASSERT_FALSE(ecoSmartUdpDecodeRequest(reply, sizeof(reply), &request));
+}
+
+void test_requests_are_not_replies(void) {
+    uint8_t out[ECOSMART_UDP_REPLY_BYTES];
+    ecoSmartUdpEncodeReply({ECOSMART_UDP_QUERY, 1, ECOSMART_UDP_ACCEPTED, EcoSmartFrame()}, out);
+    out[3] &= static_cast<uint8_t>(~ECOSMART_UDP_REPLY);
+    EcoSmartUdpReply reply;
+    TEST_ASSERT_FALSE(ecoSmartUdpDecodeReply(out, sizeof(out), &reply));
+    TEST_ASSERT_FALSE(ecoSmartUdpDecodeReply(out, ECOSMART_UDP_REQUEST_BYTES, &reply));
+}
+
+
+int main(int argc, char **argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_request_layout);
+    RUN_TEST(test_request_round_trip);
+    RUN_TEST(test_reply_round_trip);
+    RUN_TEST(test_malformed_requests_refused);
+    RUN_TEST(test_requests_are_not_replies);
+    return UNITY_END();
+}
@@ -0,0 +1,118 @@
+/*
+  Turn raw captures of failed EcoSmart decodes back into timing tables.
+
+  The firmwares log each failed capture as a base64 line starting with
+  ECOSMART_CAPTURE_PREFIX (see src/ecosmart_capture.h). Save the serial or
+  ESPHome log and run it through this tool on the host:
+
+    g++ -std=c++11 -Isrc tools/ecosmart_capture.cpp -o ecosmart_capture
+    ./ecosmart_capture < ecosmart.log
+
+  Every duration is shown with the level it was at and the part of the
+  protocol it matches, so the one that broke the frame is easy to spot.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ecosmart_capture.h"
+#include "ecosmart_decoder.h"
+
+
+static int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+// Decode base64 text up to the first character that is not part of it.
+static std::vector<uint8_t> unbase64(const char *text) {
+    std::vector<uint8_t> out;
+    uint32_t chunk = 0;
+    int bits = 0;
+    for (; base64Value(*text) >= 0; text++) {
+        chunk = (chunk << 6) | static_cast<uint32_t>(base64Value(*text));
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<uint8_t>(chunk >> bits));
+        }
+    }
+    return out;
+}
+
+static bool failedAtMark(uint8_t reason) {
+    return reason == ECOSMART_FAIL_HDR_MARK || reason == ECOSMART_FAIL_BIT_MARK || reason == ECOSMART_FAIL_REPEAT;
+}
+
+static const char *describe(uint16_t us, bool mark) {
+    if (us == UINT16_MAX) {
+        return "gap";
+    }
+    if (mark) {
+        if (ecoSmartMatchMark(us, ECOSMART_HDR_MARK)) return "header mark";
+        if (ecoSmartMatchMark(us, ECOSMART_BIT_MARK_HIGH)) return "bit 1";
+        if (ecoSmartMatchMark(us, ECOSMART_BIT_MARK_LOW)) return "bit 0";
+    } else {
+        if (ecoSmartMatchSpace(us, ECOSMART_HDR_SPACE)) return "header space";
+        if (ecoSmartMatchSpace(us, ECOSMART_RPT_SPACE)) return "repeat space";
+        if (ecoSmartMatchSpace(us, ECOSMART_BIT_SPACE)) return "bit space";
+    }
+    return "?";
+}
+
+static void print(const EcoSmartCapture &capture, unsigned int n) {
+    printf("capture %u: %s failure at %u us, %u durations\n", n, ecoSmartFailureName(capture.reason),
+           capture.micros, capture.count);
+    printf("    #  level     us  matches\n");
+    // The last duration is the one that failed, so its level is known and
+    // the rest alternate back from it.
+    bool mark = failedAtMark(capture.reason);
+    if ((capture.count - 1) % 2 != 0) {
+        mark = !mark;
+    }
+    for (uint8_t i = 0; i < capture.count; i++, mark = !mark) {
+        uint16_t us = capture.durations[i];
+        bool gap = us == UINT16_MAX;
+        printf("  %3u  %-5s  %5s  %s%s\n", i, gap ? "-" : mark ? "mark" : "space",
+               gap ? ">gap" : std::to_string(us).c_str(), describe(us, mark),
+               i + 1 == capture.count ? "  <-- failed here" : "");
+        if (gap) {
+            mark = false;  // the burst starts with a mark
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    if (argc > 1 && (in = fopen(argv[1], "r")) == nullptr) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    unsigned int found = 0;
+    unsigned int bad = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), in) != nullptr) {
+        const char *text = strstr(line, ECOSMART_CAPTURE_PREFIX);
+        if (text == nullptr) {
+            continue;
+        }
+        std::vector<uint8_t> record = unbase64(text + strlen(ECOSMART_CAPTURE_PREFIX));
+        EcoSmartCapture capture;
+        if (ecoSmartCaptureDecode(record.data(), record.size(), &capture) == 0) {
+            bad++;
+            continue;
+        }
+        print(capture, ++found);
+    }
+
+    printf("%u captures, %u unreadable\n", found, bad);
+    return 0;
+}
@@ -0,0 +1,281 @@
+/*
+  Replay a raw capture corpus (see src/ecosmart_corpus.h) through the
+  EcoSmart receiver and decoder on the host.
+
+    g++ -std=c++11 -O2 -Isrc tools/ecosmart_replay.cpp -o ecosmart_replay
+
+    ./ecosmart_replay capture.ecsr [--repeat N] [--no-vote] [--calibrate]
+    ./ecosmart_replay --connect 127.0.0.1:2323      # a remote's corpus port, or a stand-in
+    ./ecosmart_replay --synthesize synthetic.ecsr [--frames N] [--jitter US] [--seed N]
+
+  A corpus can be recorded from a running remote with e.g.
+  "nc <remote-ip> 2323 > capture.ecsr". With no hardware at hand, a
+  synthetic corpus can be served by a local stand-in instead:
+  "nc -l 2323 < synthetic.ecsr".
+
+  Reports how many frames decoded, why the rest were rejected, and how long
+  decoding took per edge and per frame.
+*/
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ecosmart_corpus.h"
+#include "ecosmart_decoder.h"
+#include "ecosmart_frame.h"
+#include "ecosmart_waveform.h"
+
+
+static bool readFile(const char *path, std::vector<uint8_t> *data) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (in == nullptr) {
+        perror(path);
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        data->insert(data->end(), buffer, buffer + n);
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    return true;
+}
+
+// Read everything a TCP peer sends until it closes the connection.
+static bool readSocket(const char *address, std::vector<uint8_t> *data) {
+    std::string host(address);
+    size_t colon = host.rfind(':');
+    if (colon == std::string::npos) {
+        fprintf(stderr, "expected HOST:PORT, got %s\n", address);
+        return false;
+    }
+    std::string port = host.substr(colon + 1);
+    host.resize(colon);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", address);
+        return false;
+    }
+    int fd = -1;
+    for (addrinfo *a = addresses; a != nullptr && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        perror(address);
+        return false;
+    }
+
+    fprintf(stderr, "reading from %s until it disconnects (Ctrl-C to stop)\n", address);
+    uint8_t buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        data->insert(data->end(), buffer, buffer + n);
+    }
+    close(fd);
+    return true;
+}
+
+
+// Bursts of three repeats of a random setting, with marks and spaces off by
+// up to +/- jitter and an occasional burst of noise in between.
+static void synthesize(std::vector<uint8_t> *data, uint32_t frames, uint32_t jitter, uint32_t seed) {
+    std::mt19937 rng(seed);
+    data->resize(ECOSMART_CORPUS_HEADER);
+    ecoSmartCorpusHeader(data->data());
+    auto put = [data](uint32_t us) {
+        uint8_t varint[5];
+        data->insert(data->end(), varint, varint + ecoSmartVarint(us != 0 ? us : 1, varint));
+    };
+
+    for (uint32_t burst = 0; burst < frames / 3; burst++) {
+        put(20000 + rng() % 80000);  // gap before the burst
+        if (rng() % 10 == 0) {
+            for (uint32_t i = 0; i < 20; i++) {
+                put(50 + rng() % 5000);
+            }
+            put(20000 + rng() % 80000);
+        }
+        uint8_t c = static_cast<uint8_t>(27 + rng() % 34);
+        EcoSmartFrame frame = EcoSmartFrame(0x0F3C000000ULL).withOn(rng() % 4 != 0).withCelsius(true)
+                .withFlow(rng() % 2 != 0).withTempC(c).withTempF(static_cast<uint8_t>(c * 9 / 5 + 32));
+        EcoSmartWaveform wave = EcoSmartWaveform::encode(frame.raw());
+        for (int repeat = 0; repeat < 3; repeat++) {
+            // the last space of the burst is swallowed by the next gap
+            uint16_t len = repeat == 2 ? wave.len - 1 : wave.len;
+            for (uint16_t i = 0; i < len; i++) {
+                int32_t offset = jitter == 0 ? 0 : static_cast<int32_t>(rng() % (2 * jitter + 1)) - jitter;
+                put(static_cast<uint32_t>(static_cast<int32_t>(wave.durations[i]) + offset));
+            }
+        }
+    }
+}
+
+
+struct Replay {
+    uint32_t durations = 0;
+    uint32_t discontinuities = 0;
+    uint32_t frames = 0;
+    std::map<uint64_t, uint32_t> values;
+    EcoSmartDecoder decoder;
+    double ns = 0;
+};
+
+// Run the corpus through a fresh receiver, exactly as the interrupt handler
+// would have fed it.
+static bool replay(const std::vector<uint8_t> &data, bool voting, bool calibrate, bool collect, Replay *result) {
+    if (!ecoSmartCorpusCheckHeader(data.data(), data.size())) {
+        fprintf(stderr, "not an EcoSmart corpus (or an unsupported version)\n");
+        return false;
+    }
+    EcoSmartReceiver receiver;
+    receiver.decoder().setVoting(voting);
+    receiver.decoder().setCalibration(calibrate);
+    uint32_t now = 0;
+    size_t pos = ECOSMART_CORPUS_HEADER;
+    uint32_t us;
+
+    auto start = std::chrono::steady_clock::now();
+    while (ecoSmartReadVarint(data.data(), data.size(), &pos, &us)) {
+        result->durations++;
+        if (us == 0) {
+            result->discontinuities++;
+            us = ECOSMART_GAP_US + 1;  // edges were lost, resynchronise as after a gap
+        }
+        now += us;
+        receiver.edge(now);
+        EcoSmartFrameRecord record;
+        while (receiver.read(&record)) {
+            result->frames++;
+            if (collect) {
+                result->values[record.frame]++;
+            }
+        }
+    }
+    result->ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    result->decoder = receiver.decoder();
+    return true;
+}
+
+
+int main(int argc, char **argv) {
+    const char *file = nullptr;
+    const char *address = nullptr;
+    const char *output = nullptr;
+    uint32_t repeat = 1;
+    uint32_t frames = 10000;
+    uint32_t jitter = 100;
+    uint32_t seed = 1;
+    bool voting = true;
+    bool calibrate = false;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (strcmp(argv[i], "--connect") == 0 && more) {
+            address = argv[++i];
+        } else if (strcmp(argv[i], "--synthesize") == 0 && more) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--repeat") == 0 && more) {
+            repeat = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--frames") == 0 && more) {
+            frames = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--jitter") == 0 && more) {
+            jitter = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--seed") == 0 && more) {
+            seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--no-vote") == 0) {
+            voting = false;
+        } else if (strcmp(argv[i], "--calibrate") == 0) {
+            calibrate = true;
+        } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+            file = argv[i];
+        } else {
+            file = nullptr;
+            address = nullptr;
+            output = nullptr;
+            break;
+        }
+    }
+
+    std::vector<uint8_t> data;
+    if (output != nullptr) {
+        synthesize(&data, frames, jitter, seed);
+        FILE *out = fopen(output, "wb");
+        if (out == nullptr || fwrite(data.data(), 1, data.size(), out) != data.size() || fclose(out) != 0) {
+            perror(output);
+            return 1;
+        }
+        printf("wrote %u frames (%zu bytes) to %s\n", frames / 3 * 3, data.size(), output);
+        return 0;
+    }
+    if (file == nullptr && address == nullptr) {
+        fprintf(stderr, "usage: %s FILE|--connect HOST:PORT [--repeat N] [--no-vote] [--calibrate]\n"
+                        "       %s --synthesize FILE [--frames N] [--jitter US] [--seed N]\n", argv[0], argv[0]);
+        return 2;
+    }
+    if (!(address != nullptr ? readSocket(address, &data) : readFile(file, &data))) {
+        return 1;
+    }
+
+    Replay result;
+    if (!replay(data, voting, calibrate, true, &result)) {
+        return 1;
+    }
+    double ns = result.ns;
+    for (uint32_t i = 1; i < repeat; i++) {
+        Replay again;
+        replay(data, voting, calibrate, false, &again);
+        ns += again.ns;
+    }
+    ns /= repeat != 0 ? repeat : 1;
+
+    const EcoSmartDecoder &decoder = result.decoder;
+    printf("corpus     : %zu bytes, %u durations, %u discontinuities\n", data.size(), result.durations,
+           result.discontinuities);
+    printf("decoded    : %u frames from %u headers (%.1f%%), voting %s\n", result.frames, decoder.attempts(),
+           decoder.attempts() ? 100.0 * decoder.decoded() / decoder.attempts() : 0.0, voting ? "on" : "off");
+    printf("rejections :");
+    for (uint8_t i = 0; i < ECOSMART_FAIL_REASONS; i++) {
+        printf(" %s=%u", ecoSmartFailureName(i), decoder.failures(static_cast<EcoSmartDecodeFailure>(i)));
+    }
+    printf("\n");
+    printf("speed      : %.2f ns/duration, %.1f ns/frame (averaged over %u runs)\n",
+           result.durations ? ns / result.durations : 0.0, result.frames ? ns / result.frames : 0.0, repeat);
+
+    EcoSmartTiming timing = decoder.timing();
+    printf("timing     : header %u/%u us, bits %u/%u/%u us, repeat space %u us (%s, %u frames)\n", timing.hdrMark,
+           timing.hdrSpace, timing.bitMarkHigh, timing.bitMarkLow, timing.bitSpace, timing.rptSpace,
+           calibrate ? "learned" : "nominal", decoder.calibrations());
+    printf("frames     :\n");
+    uint32_t shown = 0;
+    for (const auto &value : result.values) {
+        if (++shown > 20) {
+            printf("    ... %zu distinct values\n", result.values.size());
+            break;
+        }
+        EcoSmartFrame frame(value.first);
+        printf("    0x%010llX  %-4s %s  %3u F  %2u C  x%u\n", static_cast<unsigned long long>(value.first),
+               frame.on() ? "on" : "off", frame.flow() ? "flow" : "    ", frame.tempF(), frame.tempC(), value.second);
+    }
+    return 0;
+}
@@ -0,0 +1,254 @@
+/*
+  Send commands and state queries to a remote's UDP port (see
+  src/ecosmart_udp.h) and measure how long the replies take.
+
+    g++ -std=c++11 -O2 -pthread -Isrc tools/ecosmart_udp.cpp -o ecosmart_udp
+
+    ./ecosmart_udp 192.168.1.50:4210 query
+    ./ecosmart_udp 192.168.1.50:4210 heat|off
+    ./ecosmart_udp 192.168.1.50:4210 41.5                  # setpoint, in the heater's scale
+    ./ecosmart_udp --loopback [query|heat|off|TEMP] [--count N] [--timeout MS]
+
+  --count sends N requests one after another and reports the round trip as
+  min/mean/p99/max.
+
+  With --loopback the requests go to a stand-in thread on 127.0.0.1 instead.
+  It shares the message format and setpoint tables with the remote, but not
+  its request handling: standIn() below is its own copy, which takes the
+  scale from the frame's °C bit rather than the remote's use_c and sends
+  nothing to a heater. So --loopback checks the codec and measures only the
+  host's share of a round trip (loopback kernel latency plus this tool), not
+  the remote's code path or its Wi-Fi.
+*/
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ecosmart_dispatch.h"
+#include "ecosmart_frame.h"
+#include "ecosmart_temperature.h"
+#include "ecosmart_udp.h"
+
+
+static const char *const statusNames[] = {"accepted", "rejected", "unknown"};
+
+
+// Stand in for the remote: apply each request to one frame and reply, until
+// stop is set.
+static void standIn(int fd, const std::atomic<bool> *stop) {
+    EcoSmartFrame cmd = EcoSmartFrame(0x0F3C186929ULL).withCelsius(true);
+    while (!*stop) {
+        uint8_t packet[ECOSMART_UDP_REQUEST_BYTES + 1];
+        sockaddr_storage from;
+        socklen_t fromLen = sizeof(from);
+        ssize_t len = recvfrom(fd, packet, sizeof(packet), 0, reinterpret_cast<sockaddr *>(&from), &fromLen);
+        EcoSmartUdpRequest request;
+        if (len <= 0 || !ecoSmartUdpDecodeRequest(packet, static_cast<size_t>(len), &request)) {
+            continue;
+        }
+        uint8_t status = ECOSMART_UDP_ACCEPTED;
+        if (request.type == ECOSMART_UDP_SET_MODE) {
+            if (request.value == 0 || request.value == 1) {
+                cmd.setOn(request.value == 1);
+            } else {
+                status = ECOSMART_UDP_REJECTED;
+            }
+        } else if (request.type == ECOSMART_UDP_SET_TEMPERATURE) {
+            if (request.value >= ECOSMART_COMMAND_TENTHS_MIN && request.value <= ECOSMART_COMMAND_TENTHS_MAX) {
+                EcoSmartSetpoint setpoint = cmd.celsius() ? ecoSmartSetpointC(request.value)
+                                                          : ecoSmartSetpointF(request.value);
+                cmd.setTempF(setpoint.f);
+                cmd.setTempC(setpoint.c);
+            } else {
+                status = ECOSMART_UDP_REJECTED;
+            }
+        } else if (request.type != ECOSMART_UDP_QUERY) {
+            status = ECOSMART_UDP_UNKNOWN;
+        }
+        uint8_t out[ECOSMART_UDP_REPLY_BYTES];
+        ecoSmartUdpEncodeReply({request.type, request.sequence, status, cmd}, out);
+        sendto(fd, out, sizeof(out), 0, reinterpret_cast<sockaddr *>(&from), fromLen);
+    }
+}
+
+// A UDP socket connected to address ("host:port"), or -1.
+static int connectUdp(const char *address) {
+    std::string host(address);
+    size_t colon = host.rfind(':');
+    if (colon == std::string::npos) {
+        fprintf(stderr, "%s: expected HOST:PORT\n", address);
+        return -1;
+    }
+    std::string port = host.substr(colon + 1);
+    host.resize(colon);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *addresses = nullptr;
+    int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+    if (error != 0) {
+        fprintf(stderr, "%s: %s\n", address, gai_strerror(error));
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo *a = addresses; a != nullptr && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        perror(address);
+    }
+    return fd;
+}
+
+// Parse "query", "heat", "off" or a temperature into a request.
+static bool parseRequest(const char *word, EcoSmartUdpRequest *request) {
+    int32_t tenths;
+    if (strcmp(word, "query") == 0) {
+        *request = {ECOSMART_UDP_QUERY, 0, 0};
+    } else if (strcmp(word, "heat") == 0 || strcmp(word, "off") == 0) {
+        *request = {ECOSMART_UDP_SET_MODE, 0, static_cast<int16_t>(strcmp(word, "heat") == 0)};
+    } else if (ecoSmartParseTenths(reinterpret_cast<const uint8_t *>(word), static_cast<unsigned int>(strlen(word)),
+                                   ECOSMART_COMMAND_TENTHS_MIN, ECOSMART_COMMAND_TENTHS_MAX, &tenths)) {
+        *request = {ECOSMART_UDP_SET_TEMPERATURE, 0, static_cast<int16_t>(tenths)};
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+int main(int argc, char **argv) {
+    const char *address = nullptr;
+    bool loopback = false;
+    const char *word = "query";
+    uint32_t count = 1;
+    uint32_t timeoutMs = 500;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (strcmp(argv[i], "--loopback") == 0) {
+            loopback = true;
+        } else if (strcmp(argv[i], "--count") == 0 && more) {
+            count = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--timeout") == 0 && more) {
+            timeoutMs = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (argv[i][0] == '-' && !isdigit(static_cast<unsigned char>(argv[i][1]))) {
+            address = nullptr;
+            loopback = false;
+            break;
+        } else if (address == nullptr && !loopback && strchr(argv[i], ':') != nullptr) {
+            address = argv[i];
+        } else {
+            word = argv[i];
+        }
+    }
+
+    EcoSmartUdpRequest request;
+    if ((address == nullptr && !loopback) || count == 0 || !parseRequest(word, &request)) {
+        fprintf(stderr, "usage: %s HOST:PORT|--loopback [query|heat|off|TEMP] [--count N] [--timeout MS]\n",
+                argv[0]);
+        return 2;
+    }
+
+    std::atomic<bool> stop(false);
+    std::thread server;
+    int serverFd = -1;
+    char local[32];
+    if (loopback) {
+        serverFd = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in bound = {};
+        bound.sin_family = AF_INET;
+        bound.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t boundLen = sizeof(bound);
+        timeval poll = {0, 100000};
+        if (serverFd < 0 || bind(serverFd, reinterpret_cast<sockaddr *>(&bound), sizeof(bound)) != 0 ||
+            getsockname(serverFd, reinterpret_cast<sockaddr *>(&bound), &boundLen) != 0 ||
+            setsockopt(serverFd, SOL_SOCKET, SO_RCVTIMEO, &poll, sizeof(poll)) != 0) {
+            perror("loopback");
+            return 1;
+        }
+        snprintf(local, sizeof(local), "127.0.0.1:%u", ntohs(bound.sin_port));
+        address = local;
+        server = std::thread(standIn, serverFd, &stop);
+    }
+
+    int fd = connectUdp(address);
+    timeval timeout = {static_cast<time_t>(timeoutMs / 1000), static_cast<suseconds_t>(timeoutMs % 1000 * 1000)};
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+        stop = true;
+        if (server.joinable()) server.join();
+        return 1;
+    }
+
+    std::vector<double> rtts;
+    uint32_t lost = 0;
+    EcoSmartUdpReply reply = {};
+    bool replied = false;
+    for (uint32_t i = 0; i < count; i++) {
+        request.sequence = static_cast<uint16_t>(i);
+        uint8_t out[ECOSMART_UDP_REQUEST_BYTES];
+        ecoSmartUdpEncodeRequest(request, out);
+        auto start = std::chrono::steady_clock::now();
+        if (send(fd, out, sizeof(out), 0) != static_cast<ssize_t>(sizeof(out))) {
+            perror("send");
+            break;
+        }
+        // skip stale replies to earlier, timed out requests
+        bool answered = false;
+        uint8_t in[ECOSMART_UDP_REPLY_BYTES + 1];
+        ssize_t len;
+        while (!answered && (len = recv(fd, in, sizeof(in), 0)) > 0) {
+            answered = ecoSmartUdpDecodeReply(in, static_cast<size_t>(len), &reply) &&
+                       reply.sequence == request.sequence;
+        }
+        if (!answered) {
+            lost++;
+            continue;
+        }
+        rtts.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        replied = true;
+    }
+
+    stop = true;
+    if (server.joinable()) server.join();
+    close(fd);
+    if (serverFd >= 0) close(serverFd);
+
+    if (!replied) {
+        fprintf(stderr, "%s: no reply within %u ms\n", address, timeoutMs);
+        return 1;
+    }
+    EcoSmartFrame &frame = reply.frame;
+    printf("reply      : %s, frame 0x%010llX  %-4s %s  %3u F  %2u C\n",
+           reply.status < 3 ? statusNames[reply.status] : "?", static_cast<unsigned long long>(frame.raw()),
+           frame.on() ? "on" : "off", frame.flow() ? "flow" : "    ", frame.tempF(), frame.tempC());
+
+    std::sort(rtts.begin(), rtts.end());
+    double total = 0;
+    for (double rtt : rtts) {
+        total += rtt;
+    }
+    printf("round trip : %zu replies, %u lost, min %.0f us, mean %.0f us, p99 %.0f us, max %.0f us (%s)\n",
+           rtts.size(), lost, rtts.front(), total / rtts.size(), rtts[(rtts.size() - 1) * 99 / 100], rtts.back(),
+           loopback ? "loopback stand-in" : address);
+    return 0;
+}